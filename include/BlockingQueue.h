@@ -0,0 +1,67 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/*
+Bounded queue to hand work between threads. push() blocks while the queue is full,
+pop() blocks while it is empty. After close(), pop() returns false once the queue ran dry.
+*/
+template<typename T>
+class BlockingQueue {
+
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+
+    explicit BlockingQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Like pop(), but returns false right away instead of waiting for an item.
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+
+    // Wakes up all consumers, no more items are pushed after this.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <iostream>
 #include <vulkan/vulkan.h>
 
@@ -8,27 +10,290 @@
 #include <stdexcept>
 #include <cmath>
 #include <string>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <functional>
+
+#include "BlockingQueue.h"
+#include "FilterGraph.h"
+#include "TimingReport.h"
+#include "MemoryAllocator.h"
+#include "PngWriter.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
 using namespace std;
 
 const int WORKGROUP_SIZE = 32; //Workgroup size in compute shader.
 
+//Tiled shaders: pixels per workgroup along and across the blur direction,
+//and the largest radius whose halo fits the shared memory tile. Must match common.glsl.
+const int TILE_LENGTH = 64;
+const int TILE_WIDTH = 4;
+const int MAX_TILED_RADIUS = 64;
+
+//Box blur kernels: invocations per workgroup, each walking a segment of one row or column of at
+//least BOX_MIN_SEGMENT pixels. Must match common.glsl.
+const int BOX_GROUP_SIZE = 64;
+const int BOX_MIN_SEGMENT = 128;
+
+//Blur sizes up to this get their own pipeline variant with the window size as a
+//specialization constant, larger ones use the generic kernel.
+const int MAX_SPECIALIZED_BLUR_SIZE = 33;
+
+//Timestamp queries per frame: start, upload, up to two blur passes and readback.
+//A filter graph writes a single timestamp for all of its passes.
+const int MAX_TIMESTAMPS = 8;
+
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
 #else
 const bool enableValidationLayers = true;
 #endif
 
-using namespace std;
-class ComputeApplication{
+//Selects which compute kernels produce the blurred image.
+enum BlurMode {
+    BLUR_MODE_REFERENCE,    //single pass over the full n x n window, O(n^2) per pixel
+    BLUR_MODE_SEPARABLE,    //horizontal then vertical 1D pass, O(n) per pixel
+    BLUR_MODE_TILED,        //separable passes reading a shared memory tile, falls back to
+                            //BLUR_MODE_SEPARABLE when the radius does not fit the tile
+    BLUR_MODE_BOX,          //three stacked box passes per direction with running sums, O(1) per pixel.
+                            //Approximates the gaussian, see boxBlurErrorBound()
+    BLUR_MODE_GRAPH         //the passes of FilterParams::graph, picked whenever a job has a graph
+};
 
-	static uint32_t OUTPUT_WIDTH;
-	static uint32_t OUTPUT_HEIGHT;
+//Storage format of the input and output buffers. Pixel values are 0 - 255 in every format.
+//Must match the PIXEL_FORMAT defines in common.glsl.
+enum PixelFormat {
+    PIXEL_FORMAT_RGBA32F,   //4 floats, 16 bytes per pixel
+    PIXEL_FORMAT_RGBA8,     //4 bytes, same layout as the decoded image
+    PIXEL_FORMAT_RGBA16F    //4 halfs, 8 bytes per pixel
+};
 
-    // size of our storage buffer in bytes.
-    uint32_t imageSize; 
+//One compiled variant of a kernel. The blur size and workgroup size are specialization constants.
+struct PipelineKey {
+    std::string shaderName;
+    int32_t blurSize;           //window size baked into the kernel, 0 for the generic kernel
+    uint32_t workgroupWidth;    //only specialized in the non tiled kernels
+    uint32_t workgroupHeight;
+
+    bool operator<(const PipelineKey& other) const {
+        if (shaderName != other.shaderName) return shaderName < other.shaderName;
+        if (blurSize != other.blurSize) return blurSize < other.blurSize;
+        if (workgroupWidth != other.workgroupWidth) return workgroupWidth < other.workgroupWidth;
+        return workgroupHeight < other.workgroupHeight;
+    }
+};
+
+//Decoded image on the host, always 4 bytes (RGBA) per pixel.
+struct Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<unsigned char> pixels;
+
+    //Loaded images keep their pixels where the loader put them, in the decoder's buffer or a memory
+    //mapped raw file, instead of copying them into pixels. Copies of the image share the memory.
+    std::shared_ptr<const unsigned char> external;
+
+    //Images from openImage() whose format can be decoded a few rows at a time have neither pixels
+    //nor external memory yet. decodeRows writes rows [firstRow, firstRow + rowCount) as RGBA8 to rows,
+    //so strips can be decoded in parallel straight into the upload buffer.
+    std::function<void(uint32_t firstRow, uint32_t rowCount, unsigned char* rows)> decodeRows;
+    std::string format;     //file extension, for the decode statistics
 
-    //input image data
-    unsigned char* inputImageData;
+    bool decoded() const { return external || !pixels.empty(); }
+    const unsigned char* data() const { return external ? external.get() : pixels.data(); }
+};
+
+//Part of an image, in pixels. Empty when width or height is 0.
+struct ImageRect {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    bool empty() const { return width == 0 || height == 0; }
+};
+
+//Per job filter settings. Everything but blurMode and graph ends up in the push constants.
+struct FilterParams {
+    float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };    //tint, multiplied with the blurred pixel
+    float saturation = 1.7f;
+    int32_t blur = 51;                              //blur window size in pixels
+    BlurMode blurMode = BLUR_MODE_TILED;
+
+    //Replaces the blur, tint and saturation above when set. Shared, since every job of a batch
+    //and every tile uses the same graph, and jobs with the same graph reuse their recorded commands.
+    std::shared_ptr<const FilterGraph> graph;
+};
+
+//One image of a batch.
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+//Seconds each stage of a batch was busy. Divided by totalTime, this is how much of the
+//time a stage was occupied, which tells how many frames in flight are worth it.
+struct BatchStats {
+    uint32_t images = 0;
+    double totalTime = 0.0;
+    double decodeTime = 0.0;        //decode, on the decode threads
+    double decodeWaitTime = 0.0;    //submit thread waiting for a decoded image
+    double uploadTime = 0.0;        //writing buffers, recording and submitting
+    double gpuWaitTime = 0.0;       //submit thread waiting for a fence
+    double readbackTime = 0.0;      //reading the output buffer
+    double encodeTime = 0.0;        //PNG encode, on the encode thread
+    uint32_t reusedCommandBuffers = 0;  //GPU jobs submitted without recording
+    uint32_t cpuImages = 0;         //images the CPU co-processor took
+    uint32_t cachedImages = 0;      //written from the result cache, without rendering
+    double cpuTime = 0.0;           //CPU co-processor busy
+
+    //Decode throughput by file format. Streamed formats count the row strips decoded
+    //into the upload buffers as well.
+    struct FormatStats {
+        uint32_t images = 0;
+        double megapixels = 0.0;
+        double seconds = 0.0;
+    };
+    std::map<std::string, FormatStats> decodeFormats;
+
+    void print() const;
+};
+
+//The job a frame's command buffer was recorded for. The next job with the same values submits it
+//again without recording. Destroying or replacing a buffer the commands use clears valid.
+struct RecordedCommands {
+    bool valid = false;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    FilterParams params;
+    BlurMode blurMode = BLUR_MODE_TILED;
+    int32_t specializedBlurSize = 0;
+    uint32_t workgroupWidth = 0;
+    uint32_t workgroupHeight = 0;
+};
+
+/*
+Everything one job needs on the GPU. Batches keep several frames in flight, so each frame has
+its own buffers, descriptor set, command buffer and fence. A frame is only written again after
+its fence signalled.
+*/
+struct Frame {
+
+    //size of the image of the current job
+    uint32_t imageWidth = 0;
+    uint32_t imageHeight = 0;
+
+    //size of the result, differs from the image size only when a filter graph resizes
+    uint32_t outputWidth = 0;
+    uint32_t outputHeight = 0;
+
+    // size of the larger of the input and output image in the input and output storage buffers in bytes.
+    VkDeviceSize imageSize = 0;
+
+    // size of the current image in the intermediate buffer in bytes, always 4 floats per pixel.
+    // With a filter graph, of the largest image a pass writes there.
+    VkDeviceSize intermediateSize = 0;
+
+    // allocated sizes of the image buffers, they only grow.
+    VkDeviceSize imageCapacity = 0;
+    VkDeviceSize intermediateCapacity = 0;
+
+    //Stores image loaded from disk
+    VkBuffer inputBuffer;
+    Allocation inputBufferMemory;
+
+	//Image buffer to be exported
+	VkBuffer outputBuffer;
+	Allocation outputBufferMemory;
+
+    //host visible copies of the input and output, only used with staging buffers
+    VkBuffer inputStagingBuffer;
+    Allocation inputStagingBufferMemory;
+    VkBuffer outputStagingBuffer;
+    Allocation outputStagingBufferMemory;
+
+    //The input of the current job, imported with VK_EXT_external_memory_host and copied to
+    //inputBuffer by the GPU. Keeps the host memory alive until the job finished.
+    VkBuffer importedInputBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory importedInputMemory = VK_NULL_HANDLE;
+    std::shared_ptr<const unsigned char> importedPixels;
+
+    //where the CPU writes the input and reads the output, staging or not.
+    //Host visible memory stays mapped, so these are valid as long as the buffers.
+    void* inputHostPointer;
+    void* outputHostPointer;
+
+    //ms spent decoding row strips of a streamed input into the input buffer
+    double rowDecodeTime = 0.0;
+
+    //Holds the horizontally blurred image between the two separable passes.
+    VkBuffer intermediateBuffer;
+    Allocation intermediateBufferMemory;
+
+    //The box blur passes alternate between the intermediate buffer and this one.
+    //Only created for the first box blur job of the frame.
+    VkBuffer boxBuffer;
+    Allocation boxBufferMemory;
+    VkDeviceSize boxCapacity = 0;
+
+    //Normalized 1D gaussian weights, only rewritten when the blur size changes between jobs.
+    VkBuffer weightBuffer;
+    Allocation weightBufferMemory;
+    VkDeviceSize weightBufferCapacity = 0;
+    int32_t weightBufferBlur = -1;
+
+    //Operations and blur weights of the filter graph of the current job, only rewritten when the
+    //graph changes between jobs. Holds on to the graph, so a new graph never has the same address.
+    VkBuffer graphBuffer;
+    Allocation graphBufferMemory;
+    VkDeviceSize graphBufferCapacity = 0;
+    std::shared_ptr<const FilterGraph> graphBufferGraph;
+
+    //passes of the current filter graph, and where their operations and weights start in the graph buffer
+    std::vector<FilterPass> graphPasses;
+    std::vector<uint32_t> graphOpStarts;
+    std::vector<uint32_t> graphWeightStarts;
+
+    VkDescriptorSet descriptorSet;
+
+    //mode recorded for the current job, after falling back from an unsupported tiled blur
+    BlurMode activeBlurMode = BLUR_MODE_TILED;
+
+    //window size of the pipeline variants recorded for the current job, 0 for the generic kernels
+    int32_t specializedBlurSize = 0;
+
+    //recorded again only when a job differs from the one it was recorded for
+    VkCommandBuffer commandBuffer;
+    RecordedCommands recorded;
+    bool reusedCommands = false;    //the current job did not record
+
+    //signalled when the GPU finished the job of this frame
+    VkFence fence;
+    bool inFlight = false;
+    size_t jobIndex = 0;    //batch job or tile running on this frame
+
+    //one timestamp after every recorded stage, named after the stage it ends
+    VkQueryPool queryPool;
+    std::vector<std::string> timestampNames;
+
+    //host and GPU timings of the current job
+    ImageTimings timings;
+};
+
+using namespace std;
+
+class CpuEngine;
+
+/*
+Long lived processing context. init() creates the instance, device, layouts, pipelines and
+command buffers once, then process() can be called for any number of images. Buffers are
+only reallocated when an image is larger than any image processed before.
+processBatch() overlaps decoding, upload, compute and encoding of consecutive images.
+*/
+class ComputeApplication{
 
     //In order to use Vulkan, you must create an instance. 
     VkInstance instance;
@@ -39,29 +304,32 @@ class ComputeApplication{
     //The physical device is some device on the system that supports usage of Vulkan.
     //Often, it is simply a graphics card that supports Vulkan. 
     VkPhysicalDevice physicalDevice;
+    VkPhysicalDeviceProperties deviceProperties;
 
     //Then we have the logical device VkDevice, which basically allows 
     //us to interact with the physical device. 
     VkDevice device;
 
-    //Stores image loaded from disk
-    VkBuffer inputBuffer;
-    VkDeviceMemory inputBufferMemory;
-    
-    //Uniform buffer used to pass simple parameters to compute shader
-    VkBuffer uniformBuffer;
-    VkDeviceMemory uniformBufferMemory;
+    //When device local memory is not host visible, the input and output buffers live in
+    //device local memory and the CPU reads and writes host visible staging copies instead.
+    bool useStagingBuffers;
 
-	//Image buffer to be exported
-	VkBuffer outputBuffer;
-	VkDeviceMemory outputBufferMemory;
+    //Every buffer is placed in a few large blocks of device memory instead of one allocation each.
+    MemoryAllocator allocator;
+
+    //decodes and converts row strips of the input in writeToInputBuffer()
+    ThreadPool uploadPool;
+
+    //VK_EXT_external_memory_host lets the GPU read the loaded image where it is, without a CPU copy
+    bool externalMemoryHostSupported = false;
+    VkDeviceSize minImportedHostPointerAlignment = 0;
+    PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = NULL;
 
     //Descriptors provide a way of accessing resources in shaders. They allow us to use 
     //things like uniform buffers, storage buffers and images in GLSL. 
     //A single descriptor represents a single resource, and several descriptors are organized
     //into descriptor sets, which are basically just collections of descriptors.
     VkDescriptorPool descriptorPool;
-    VkDescriptorSet descriptorSet;
     VkDescriptorSetLayout descriptorSetLayout;
     
 
@@ -69,19 +337,83 @@ class ComputeApplication{
     VkShaderModule computeShaderModule;
 
     //The pipeline specifies the pipeline that all graphics and compute commands pass though in Vulkan.
-    //We will be creating a simple compute pipeline in this application. 
-    VkPipeline computePipeline;
+    //All of our kernels share one pipeline layout. Pipelines are compiled the first time
+    //a job needs them, and kept per shader, blur size and workgroup size.
+    std::map<PipelineKey, VkPipeline> pipelines;
+    bool specializeBlurSize = true;
+
+    //blur radius above which the box blur is used
+    int32_t boxBlurRadius = MAX_TILED_RADIUS;
+
+    //submit a frame's command buffer again while jobs match the one it was recorded for
+    bool reuseCommandBuffers = true;
+
+    //workgroup size of the non tiled kernels
+    uint32_t workgroupWidth = WORKGROUP_SIZE;
+    uint32_t workgroupHeight = WORKGROUP_SIZE;
+
+    //Fastest workgroup size and blur mode autotune() measured on this device, loaded by init().
+    //The file holds one line per device, so a shared home directory works with several GPUs.
+    std::string workgroupProfileFile = "workgroup_profile.txt";
+    BlurMode tunedBlurMode = BLUR_MODE_TILED;
     VkPipelineLayout pipelineLayout;
+
+    //Compiled pipelines, saved to pipelineCacheFile in cleanup() and loaded again by init().
+    //The times are in ms, to report how much the warm cache saved.
+    VkPipelineCache pipelineCache;
+    std::string pipelineCacheFile = "pipeline_cache.bin";
+    bool pipelineCacheLoaded = false;
+    size_t pipelineCacheLoadedSize = 0;
+    double pipelineCreationTime = 0.0;
+    double coldPipelineCreationTime = 0.0;
+    double uncachedPipelineCreationTime = 0.0;  //of the pipelines the cache did not hold yet
+    size_t pipelineCacheDataSize = 0;           //after the last pipeline, it grows with each new one
+
+    PixelFormat pixelFormat = PIXEL_FORMAT_RGBA8;
     
 
     //The command buffer is used to record commands, that will be submitted to a queue.
     //To allocate such command buffers, we use a command pool.
+    //Each frame has its own command buffer, re-recorded for every job, since image size and blur mode can change.
     VkCommandPool commandPool;
-    VkCommandBuffer commandBuffer;
+
+    //jobs in flight at the same time, single jobs only use the first frame
+    std::vector<Frame> frames;
+    uint32_t framesInFlight = 1;
+
+    //Frame of processIncremental(), created by its first call. Other jobs never use it, so between
+    //calls its input, intermediate and box buffers hold the input, the horizontal blur and the
+    //blurred image of the last call.
+    Frame editFrame;
+    bool editFrameCreated = false;
+    int32_t editBlur = 0;   //window size of the blurred image in the box buffer, 0 for none
+
+    //GPU timestamps, if the compute queue supports them
+    bool timestampsSupported = false;
+    uint64_t timestampMask;
+    float timestampPeriod;
+
+    //receives the timings of every image processed by processFile() and processBatch()
+    TimingReport* timingReport = NULL;
+
+    //takes a share of the images in processBatch(), if set
+    CpuEngine* cpuCoprocessor = NULL;
+
+    //earlier results of processFile() and processBatch(), if set
+    ResultCache* resultCache = NULL;
+
+    bool verbose = true;
+
+    //largest buffer a job may use before the image is split into tiles, 0 for the device limit
+    VkDeviceSize tileMemoryBudget = 0;
+
+    //deflate level of the png files written by processFile() and processBatch()
+    int pngCompressionLevel = PNG_DEFAULT_COMPRESSION;
 
     
-    //used to enable a basic validation layer
+    //used to enable a basic validation layer, if it is installed
     std::vector<const char *> enabledLayers;
+    bool useValidationLayers = false;
 
     
     /*In order to execute commands on a device(GPU), the commands must be submitted
@@ -101,13 +433,124 @@ class ComputeApplication{
 
 public:
 
-	void run();
+    // Creates every Vulkan object that does not depend on the image.
+    void init();
 
-private:
+    // Blurs, tints and saturates one image, or runs its filter graph. Can be called any number of times between init() and cleanup().
+    Image process(const Image& input, const FilterParams& params);
+
+    // For interactive editing of one image: like process(), but the blurred image stays on the device
+    // until the next call. With the same image size and blur size as the last call, only the pixels
+    // within the blur radius of changed, the part of the input that differs from the last call, are
+    // blurred again, and with nothing changed only tint, saturation and clamping run. Blurs with the
+    // separable gaussian, which gives the result of the tiled blur too. Jobs that would run the box or
+    // the reference blur, filter graphs and images that need tiles go through process() instead.
+    Image processIncremental(const Image& input, const FilterParams& params, const ImageRect& changed = ImageRect());
+
+    // Loads, processes and saves one image.
+    void processFile(const BatchJob& job, const FilterParams& params);
+
+    // Loads, processes and saves a list of images, with up to framesInFlight images on the GPU at once.
+    BatchStats processBatch(const std::vector<BatchJob>& jobs, const FilterParams& params);
+
+    // Destroys all Vulkan resources.
+    void cleanup();
+
+    //must be set before init()
+    void setPixelFormat(PixelFormat format);
+    void setFramesInFlight(uint32_t count);
+
+    void setTimingReport(TimingReport* report);
+
+    // Lets the CPU engine process images next to the GPU in processBatch().
+    void setCpuCoprocessor(CpuEngine* engine);
+
+    // Looks up every job of processFile() and processBatch() in the cache first, and adds the results
+    // of the others. Hits are only decoded and hashed, then their output file is written as it was.
+    void setResultCache(ResultCache* cache);
+
+    // Images whose buffers would exceed this many bytes, or maxStorageBufferRange, are processed in tiles.
+    void setTileMemoryBudget(VkDeviceSize bytes);
+
+    // Pixels of the largest image one frame's buffers hold, after init(). Larger inputs are processed in
+    // tiles, and a filter graph must not resize to more.
+    uint64_t maxImagePixels() const;
+
+    // 0 stores the png output uncompressed, the fastest to write, up to 9 for the smallest files.
+    void setPngCompressionLevel(int level);
+
+    //prints per job messages, on by default
+    void setVerbose(bool enabled);
+
+    // Timings of the last process() or processIncremental() call.
+    const ImageTimings& lastTimings() const;
+
+    static const char* blurModeName(BlurMode mode);
+
+    //compile blur sizes up to MAX_SPECIALIZED_BLUR_SIZE into their own pipelines, on by default
+    void setSpecializeBlurSize(bool enabled);
+
+    // Jobs with a blur radius above this use the box blur, unless they asked for the reference kernel.
+    // 0 turns the switch off. MAX_TILED_RADIUS by default, where the tiled blur stops working.
+    void setBoxBlurRadius(int32_t radius);
+
+    // Whether a job runs the box blur. Its result is not the gaussian the CPU engine computes, so these
+    // jobs are not given to the CPU coprocessor and can not be verified against the CPU engine.
+    bool usesBoxBlur(const FilterParams& params) const;
+
+    // Keep the recorded commands of a frame for the next job of the same size and settings, on by default.
+    void setReuseCommandBuffers(bool enabled);
+
+    // Times candidate workgroup sizes, and the tiled against the separable blur, on this device with a
+    // sample image. Keeps the fastest and saves it to the workgroup profile, so later runs start with it.
+    // Blur sizes that would run the box blur are tuned at the box blur radius, and the graph is left out.
+    void autotune(const Image& sample, const FilterParams& params);
+
+    //empty to disable the workgroup profile, must be set before init()
+    void setWorkgroupProfileFile(const std::string& filename);
+
+    //empty to disable the on-disk pipeline cache, must be set before init()
+    void setPipelineCacheFile(const std::string& filename);
+
+    // Prints whether images go through staging buffers, how much device memory the buffers take and how fragmented it is.
+    void printMemoryStats() const;
+
+    // Prints the time spent creating pipelines, and with a warm cache how much it saved.
+    void printPipelineCacheStats() const;
 
     //Load and saving image
-    void loadImage();
-    void saveRenderedImage();
+    static Image loadImage(const std::string& filename);
+
+    // Like loadImage(), but uncompressed formats are only opened, and decoded later in row strips,
+    // straight into the input buffer. Other formats are decoded in their own channel count. Prints
+    // nothing, since the decode threads of processBatch() call it at once.
+    static Image openImage(const std::string& filename);
+
+    // Decodes the rows of an image from openImage() into its pixels, if they are not there yet.
+    static void decodeImage(Image& image);
+    static void saveImage(const Image& image, const std::string& filename, int compressionLevel = PNG_DEFAULT_COMPRESSION);
+
+    // The file saveImage() writes, as bytes.
+    static std::vector<unsigned char> encodeImage(const Image& image, const std::string& filename, int compressionLevel = PNG_DEFAULT_COMPRESSION);
+
+    // Bytes one pixel takes in the input and output buffers.
+    static uint32_t bytesPerPixel(PixelFormat format);
+
+    // Returns the normalized 1D gaussian the shaders use for a given blur size.
+    static std::vector<float> computeGaussWeights(int32_t blur);
+
+    // Radii of the three stacked box passes whose variance is closest to the gaussian of a blur size.
+    static void computeBoxRadii(int32_t blur, int32_t radii[3]);
+
+    // Largest difference the box blur can make on any image, in levels of 255, against the separable
+    // gaussian of the same blur size, before tint and saturation. Computed from the 1D kernels: it is
+    // 255 times their L1 distance. The 2D kernels are products of them, which at most doubles the
+    // distance, and it takes both positive and negative differences to move a pixel, which halves it.
+    // For blur sizes from 9 to 1025 this is 10 to 25 levels. A hard edge is off by 1.4 to 6.3
+    // levels, most of it from the gaussian being cut off at 2 sigma.
+    static double boxBlurErrorBound(int32_t blur);
+
+private:
 
     //app info
     void createInstance();
@@ -118,33 +561,104 @@ private:
     uint32_t getComputeQueueFamilyIndex();
 
 
-    //GPU buffers
-    void createInputBuffer();
-    void writeToInputBuffer();
+    // Decides between direct mapping and staging buffers for the image buffers.
+    void detectUnifiedMemory();
+
+    //GPU buffers, with memory from the allocator
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+        VkBuffer& buffer, Allocation& bufferMemory, VkMemoryPropertyFlags preferredProperties = 0);
+    void destroyBuffer(VkBuffer& buffer, Allocation& bufferMemory);
+
+    // Reallocates the image buffers of a frame when the current job does not fit them.
+    void reserveImageBuffers(Frame& frame);
+    void reserveBoxBuffer(Frame& frame);
+    void destroyImageBuffers(Frame& frame);
+
+    void createInputBuffer(Frame& frame);
 
-    void createUniformBuffer();
-    void writeToUniformBuffer();
+    // Imports the loaded pixels of an RGBA8 image as the upload source, false if they have to be copied.
+    bool importInput(Frame& frame, const Image& input);
+    void releaseImportedInput(Frame& frame);
+    void writeToInputBuffer(Frame& frame, const Image& input, uint32_t firstRow = 0, uint32_t rowCount = UINT32_MAX);
 
-	void createOutputBuffer();
 
-    // find memory type with desired properties.
-    uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
+	void createOutputBuffer(Frame& frame);
+    void readFromOutputBuffer(Frame& frame, Image& output);
+
+    void createIntermediateBuffer(Frame& frame);
+
+    void createWeightBuffer(Frame& frame, VkDeviceSize size);
+    void writeToWeightBuffer(Frame& frame, int32_t blur);
+
+    // Compiles the graph of a job into the passes of a frame and writes their data.
+    void writeToGraphBuffer(Frame& frame, const FilterParams& params);
 
 
     void createDescriptorSetLayout();
 
     void createDescriptorSet();
+    void updateDescriptorSet(Frame& frame);
 
     
-    void createComputePipeline();
+    void createPipelineLayout();
+
+    // Loads the pipeline cache file if it matches this device and driver.
+    void createPipelineCache();
+    void savePipelineCache();
+
+    // Reads and writes this device's line of the workgroup profile.
+    void loadWorkgroupProfile();
+    void saveWorkgroupProfile();
+    std::string deviceProfileKey() const;
+
+    // Median GPU time of a job in ms, or wall time without timestamp queries.
+    double measureKernel(const Image& sample, const FilterParams& params, int repeat);
 
     std::vector<char> readFile(const std::string& filename);
+    VkPipeline createPipelineFromShader(const PipelineKey& key);
+
+    // Returns the variant of a kernel for a blur size, compiling it on first use.
+    VkPipeline getPipeline(const std::string& shaderName, int32_t blurSize);
+
+    // Picks the mode to record, tiled kernels need the radius and workgroup to fit the device.
+    BlurMode resolveBlurMode(const FilterParams& params);
+
     void createCommandBuffer();
+    void recordCommandBuffer(Frame& frame, const FilterParams& params);
+    void recordReadback(Frame& frame);
+    bool canReuseCommands(const Frame& frame, const FilterParams& params) const;
+    void recordBufferBarrier(VkCommandBuffer commandBuffer, VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
+        VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask);
 
 
-    void runCommandBuffer();
+    // Everything but the pixels that the output file of a job depends on, for the result cache key.
+    std::string resultSettings(const FilterParams& params, const std::string& outputName) const;
 
-    void cleanup();
+    // True when the image does not fit the buffer limits and has to be split.
+    bool needsTiling(const Image& input) const;
+    VkDeviceSize maxTileBytes() const;
+
+    // Processes a large image as tiles with a halo of blur radius pixels.
+    Image processTiled(const Image& input, const FilterParams& params);
+
+    // Writes a job into a frame and records its commands.
+    void prepareFrame(Frame& frame, const Image& input, const FilterParams& params);
+
+    // Gives editFrame its weight table, descriptor set, command buffer, fence and query pool.
+    void createEditFrame();
+
+    // Records the passes of processIncremental(): the rows of upload are copied, the horizontal and vertical
+    // blur run over their regions, then tint, saturation and clamping over the whole image. Empty parts are skipped.
+    void recordIncremental(Frame& frame, const FilterParams& params, const ImageRect& upload,
+        const ImageRect& horizontal, const ImageRect& vertical);
+    void destroyFrame(Frame& frame);
+
+    void submitFrame(Frame& frame);
+    void waitForFrame(Frame& frame);
+
+    void createTimestampQueries();
+    void writeTimestamp(Frame& frame, const std::string& stage);
+    void readTimestamps(Frame& frame);
 };
 
 //debug callback
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ComputeApplication.h"
+#include "ThreadPool.h"
+
+//How far two images are apart, per 8 bit channel.
+struct ImageDifference {
+    int maxDifference = 0;
+    size_t differingPixels = 0;     //pixels with any channel off by more than the tolerance
+};
+
+/*
+CPU implementation of the compute shaders: the same gaussian weights, tint, saturation and
+0 - 255 clamp, computed as a separable blur with SSE inner loops and rows split over a thread pool.
+Used when there is no Vulkan device, next to the GPU in batches, and as the golden reference
+for the GPU kernels.
+*/
+class CpuEngine {
+
+    ThreadPool pool;
+
+public:
+
+    // 0 threads uses one thread per hardware thread.
+    explicit CpuEngine(size_t threadCount = 0);
+
+    // Same result as ComputeApplication::process() with the RGBA8 pixel format, up to float rounding.
+    Image process(const Image& input, const FilterParams& params);
+
+    // Compares two images of the same size.
+    static ImageDifference compare(const Image& first, const Image& second, int tolerance);
+};
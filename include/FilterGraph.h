@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//Operations of a FilterGraph. The per pixel ones are numbered as in graph.comp, must match
+//the GRAPH_OP defines in common.glsl.
+enum FilterOpType {
+    FILTER_OP_TINT = 1,                 //multiply with a color
+    FILTER_OP_SATURATION = 2,           //like saturate() in the fixed kernels
+    FILTER_OP_BRIGHTNESS_CONTRAST = 3,  //scale around mid gray, then add
+    FILTER_OP_LUT = 4,                  //256 entry table per channel
+    FILTER_OP_BLUR,                     //separable gaussian, a stencil
+    FILTER_OP_SHARPEN,                  //unsharp mask over the 3x3 neighbourhood, a stencil
+    FILTER_OP_RESIZE                    //bilinear, a stencil that changes the image size
+};
+
+struct FilterOp {
+    FilterOpType type;
+    float values[4] = { 0.0f, 0.0f, 0.0f, 0.0f };  //tint color, saturation, brightness and contrast, sharpen amount
+    int32_t size = 0;                               //blur window size
+    uint32_t width = 0;                             //resize target
+    uint32_t height = 0;
+    std::vector<float> lut;                         //256 RGBA entries, 0 - 255
+
+    // Per pixel operations only read the pixel they write.
+    bool isPointOp() const;
+};
+
+//What a pass reads around each pixel. Must match the GRAPH_STENCIL defines in common.glsl.
+enum FilterStencil {
+    FILTER_STENCIL_NONE,
+    FILTER_STENCIL_BLUR_HORIZONTAL,
+    FILTER_STENCIL_BLUR_VERTICAL,
+    FILTER_STENCIL_SHARPEN,
+    FILTER_STENCIL_RESIZE
+};
+
+//One dispatch: the stencil, then the per pixel operations fused into it, in order.
+struct FilterPass {
+    FilterStencil stencil = FILTER_STENCIL_NONE;
+    int32_t blurSize = 0;
+    float amount = 0.0f;
+    uint32_t width = 0;     //size the pass writes
+    uint32_t height = 0;
+    std::vector<size_t> pointOps;   //indices into FilterGraph::operations()
+};
+
+/*
+A chain of filters applied to an image in order, as an alternative to the fixed blur, tint and
+saturation of FilterParams. compile() turns it into GPU passes: per pixel operations are fused
+into the pass before them, so they cost no extra dispatch and no trip through memory. Only
+stencils, which read the neighbours of a pixel, start a new pass, and the passes ping-pong
+between two float buffers.
+
+    FilterGraph graph;
+    graph.blur(25).brightnessContrast(10.0f, 1.2f).gamma(2.2f).resize(960, 540).sharpen(0.5f);
+*/
+class FilterGraph {
+
+    std::vector<FilterOp> ops;
+
+public:
+
+    FilterGraph& blur(int32_t size);
+    FilterGraph& tint(float r, float g, float b, float a);
+    FilterGraph& saturation(float amount);
+    FilterGraph& brightnessContrast(float brightness, float contrast);
+
+    // table holds 256 RGBA entries in the 0 - 255 range, indexed by the rounded channel value.
+    FilterGraph& lut(const std::vector<float>& table);
+    FilterGraph& gamma(float gamma);
+
+    // Bilinear, shrinking by more than half should follow a blur to avoid aliasing.
+    FilterGraph& resize(uint32_t width, uint32_t height);
+    FilterGraph& sharpen(float amount);
+
+    // Parses a comma separated list like "blur=25,tint=1:0.8:0.6:1,saturation=1.7,brightness=10:1.2,
+    // gamma=2.2,resize=960x540,sharpen=0.5". Throws std::runtime_error on anything else.
+    static FilterGraph parse(const std::string& description);
+
+    const std::vector<FilterOp>& operations() const;
+
+    // Passes for an input of the given size. Leading per pixel operations get a pass of their own,
+    // and an empty graph one that copies the image.
+    std::vector<FilterPass> compile(uint32_t width, uint32_t height) const;
+
+    // Pixels around a pixel that the stencils read, summed over the passes. The halo tiles need.
+    int32_t reach() const;
+
+    bool resizes() const;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "BlockingQueue.h"
+#include "ComputeApplication.h"
+
+//Largest blur window a job may ask for, also inside filter graphs. The range boxBlurErrorBound() covers.
+const int32_t MAX_JOB_BLUR = 1025;
+
+//Parsed graphs the server keeps for later jobs, the least recently used one is dropped first.
+const size_t MAX_CACHED_GRAPHS = 64;
+
+//Latency histogram of the job server: bucket i counts jobs that took less than 2^i ms from
+//arriving to finishing, the last bucket everything slower.
+const int LATENCY_BUCKETS = 16;
+
+struct ServerStats {
+    uint64_t accepted = 0;      //jobs that made it into the queue
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t batches = 0;       //processBatch() calls, completed / batches jobs each on average
+    size_t queueDepth = 0;      //jobs waiting right now
+    size_t maxQueueDepth = 0;
+    double uptime = 0.0;        //seconds since run() started
+    double busyTime = 0.0;      //seconds spent processing batches
+    std::array<uint64_t, LATENCY_BUCKETS> latency;
+
+    ServerStats() { latency.fill(0); }
+
+    // One line of JSON, the reply to the stats command.
+    std::string toJson() const;
+};
+
+/*
+Keeps the Vulkan device, pipelines and buffers of an initialized ComputeApplication warm and runs
+jobs sent by local clients over a Unix domain socket. Every connection sends one request per line
+and gets one line back:
+
+    process input=in.png output=out.png [blur=N] [saturation=S] [tint=R:G:B:A] [graph=DESCRIPTION]
+        -> ok <latency ms> | error <message>
+    stats -> one line of JSON, see ServerStats
+    quit  -> ok, the server finishes the queued jobs and returns from run()
+
+Fields are separated by tabs, or by spaces if the line has no tab, so paths with spaces need tabs.
+Inputs can be shared memory objects named like raw files, shm:/frame.1920x1080.rgba.
+Settings a job leaves out come from the server's defaults. Blur sizes above MAX_JOB_BLUR and graphs
+that resize to more than the device buffers hold get an error reply without being queued.
+
+Jobs wait in a bounded queue. When it is full, the connection stops reading until there is room,
+so a client that sends faster than the GPU processes is slowed down instead of the server growing.
+The worker takes up to maxBatch waiting jobs at once, and jobs with the same settings run as one
+processBatch(), overlapping decode, upload, compute and encode. A connection waits for the reply to
+its job before it reads the next one, so clients open one connection per job they want in flight.
+*/
+class JobServer {
+
+    struct Job {
+        BatchJob files;
+        FilterParams params;
+        std::chrono::high_resolution_clock::time_point arrival;
+        std::promise<std::string> reply;
+    };
+
+    ComputeApplication& app;
+    FilterParams defaults;
+    size_t maxBatch;
+
+    BlockingQueue<std::shared_ptr<Job>> queue;
+    std::atomic<bool> stopping;
+    int listenSocket = -1;
+
+    //parsed graphs by description, so repeated jobs share the graph and its recorded commands
+    struct CachedGraph {
+        std::shared_ptr<const FilterGraph> graph;
+        uint64_t lastUse = 0;
+    };
+    std::mutex graphMutex;
+    std::map<std::string, CachedGraph> graphs;
+    uint64_t graphUses = 0;
+
+    //sockets of the connections still being served, shut down when the server stops
+    std::mutex connectionMutex;
+    std::condition_variable connectionsClosed;
+    std::vector<int> connections;
+
+    std::mutex statsMutex;
+    ServerStats counters;
+    std::chrono::high_resolution_clock::time_point startTime;
+
+    void serveConnection(int connection);
+    std::string handleRequest(const std::string& line);
+    // Throws std::runtime_error for settings that would fail on the device, so the job gets an error reply.
+    std::shared_ptr<Job> parseJob(const std::vector<std::string>& fields);
+    void checkGraph(const FilterGraph& graph) const;
+
+    // Runs a group of jobs with the same settings and replies to each of them.
+    void runBatch(const std::vector<std::shared_ptr<Job>>& jobs);
+    void finishJob(Job& job, const std::string& error);
+    void worker();
+
+public:
+
+    // app must be initialized. queueCapacity jobs wait at most, maxBatch run at once.
+    JobServer(ComputeApplication& app, const FilterParams& defaults, size_t queueCapacity = 64, size_t maxBatch = 8);
+
+    // Listens on socketPath, replacing a stale socket file, until a client sends quit.
+    // Throws std::runtime_error if the socket can not be created.
+    void run(const std::string& socketPath);
+
+    ServerStats stats();
+};
+
+//Connects to a JobServer, for scripts and tests on the same machine.
+class JobClient {
+
+    int connection = -1;
+    std::string buffered;
+
+public:
+
+    explicit JobClient(const std::string& socketPath);
+    ~JobClient();
+    JobClient(const JobClient&) = delete;
+    JobClient& operator=(const JobClient&) = delete;
+
+    // Sends one request line and waits for the reply line.
+    std::string request(const std::string& line);
+};
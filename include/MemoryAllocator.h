@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+//A range of device memory handed out by MemoryAllocator. Buffers bind memory at offset.
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    size_t block = 0;
+    void* mapped = NULL;    //host pointer to offset, NULL unless the memory is host visible
+};
+
+//What the allocator holds at one point in time.
+struct MemoryStats {
+    size_t blocks = 0;                  //vkAllocateMemory calls currently alive
+    size_t allocations = 0;             //sub-allocations handed out
+    VkDeviceSize reservedBytes = 0;     //size of all blocks
+    VkDeviceSize usedBytes = 0;
+    size_t freeRanges = 0;
+    VkDeviceSize largestFreeRange = 0;
+
+    // Share of the free space not in the largest free range, 0 when nothing is fragmented.
+    double fragmentation() const;
+    void print() const;
+};
+
+/*
+Sub-allocating device memory allocator. Each memory type gets large blocks from vkAllocateMemory,
+and buffers are placed in them at their required alignment from a free list, so a batch of many
+images stays far below maxMemoryAllocationCount. Host visible blocks are mapped once for their
+whole lifetime, since a VkDeviceMemory can only be mapped once at a time and several buffers share it.
+
+Not thread safe, like the rest of ComputeApplication it is used from the submitting thread only.
+*/
+class MemoryAllocator {
+
+    struct Block {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint32_t memoryType;
+        bool dedicated;         //larger than blockSize, freed as soon as it is empty
+        void* mapped;
+        size_t allocations;
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;    //offset to size, merged on free
+    };
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkDeviceSize blockSize = 0;
+
+    //queried once, not for every allocation
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+
+    //freed blocks keep their slot with a null memory handle, so Allocation::block stays valid
+    std::vector<Block> blocks;
+
+    bool allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+    size_t createBlock(uint32_t memoryType, VkDeviceSize size);
+    void destroyBlock(Block& block);
+
+public:
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64 * 1024 * 1024);
+    void cleanup();
+
+    const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const;
+
+    // Index of a memory type allowed by memoryTypeBits with all the properties, or -1.
+    uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const;
+
+    // Places memory for the requirements in a memory type with the required properties, and with the
+    // preferred ones too if some memory type has them. Throws when the device is out of memory.
+    Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+        VkMemoryPropertyFlags preferredProperties = 0);
+    void free(Allocation& allocation);
+
+    MemoryStats getStats() const;
+};
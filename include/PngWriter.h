@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "ThreadPool.h"
+
+//zlib style levels: 0 only stores, which is the fastest for intermediate files, 9 compresses the most.
+const int PNG_STORE = 0;
+const int PNG_DEFAULT_COMPRESSION = 6;
+const int PNG_BEST_COMPRESSION = 9;
+
+/*
+RGBA8 PNG writer that compresses bands of rows in parallel. Every band is deflated on its own, with
+the 32KB before it as its window, and ends on a byte boundary with an empty stored block (a sync flush,
+like pigz does), so the bands join into a single valid zlib stream. Each band goes into its own IDAT
+chunk, so the chunk CRCs are computed in parallel as well.
+
+The deflate encoder uses the fixed Huffman codes, like stb_image_write, with hash chains whose
+length grows with the level.
+*/
+class PngWriter {
+
+    ThreadPool pool;
+
+public:
+
+    // 0 threads uses one thread per hardware thread.
+    explicit PngWriter(size_t threadCount = 0);
+
+    // Encodes width x height RGBA8 pixels, rows tightly packed.
+    std::vector<unsigned char> encode(const unsigned char* pixels, uint32_t width, uint32_t height, int level);
+
+    // Encodes and writes a file, false if it could not be written.
+    bool write(const std::string& filename, const unsigned char* pixels, uint32_t width, uint32_t height, int level);
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+//Part of every key. Bump it when a kernel change alters the results, so results of the old
+//kernels on disk are no longer found.
+const uint32_t RESULT_CACHE_VERSION = 1;
+
+struct ResultCacheStats {
+    uint64_t lookups = 0;
+    uint64_t memoryHits = 0;
+    uint64_t diskHits = 0;
+    uint64_t stores = 0;
+    uint64_t resultBytesServed = 0;     //encoded output written from the cache instead of rendered
+    uint64_t uploadBytesSaved = 0;      //input bytes hits did not upload to the GPU
+    uint64_t memoryBytes = 0;           //held by the in-memory tier now
+
+    double hitRate() const;
+    void print() const;
+};
+
+/*
+Results of earlier jobs, addressed by their content: a hash of the decoded pixels and a description
+of everything else that changes the output, the filter settings, the pixel format, the output
+format and RESULT_CACHE_VERSION. The values are the finished output files, so a hit skips the
+upload, the kernels, the readback and the encode, and only writes the file.
+
+Recently used results stay in memory up to a byte budget, the least recently used go first. With
+a directory, every result is written there as well, and results that fell out of memory, or that
+another process rendered, are read back from it. Nothing is ever removed from the directory.
+All methods can be called from several threads.
+*/
+class ResultCache {
+
+    struct Entry {
+        std::shared_ptr<const std::vector<unsigned char>> file;
+        std::list<std::string>::iterator recent;
+    };
+
+    size_t memoryBudget;
+    std::string directory;
+
+    std::mutex mutex;
+    std::list<std::string> recentKeys;  //most recently used first
+    std::unordered_map<std::string, Entry> entries;
+    ResultCacheStats counters;
+
+    void insert(const std::string& key, std::shared_ptr<const std::vector<unsigned char>> file);
+    std::string diskPath(const std::string& key) const;
+
+public:
+
+    // An empty directory keeps results in memory only. The directory has to exist.
+    explicit ResultCache(size_t memoryBudget = 256 * 1024 * 1024, const std::string& directory = "");
+
+    // 64 bit hash of a block of memory, a few GB/s on one core.
+    static uint64_t hash(const void* data, size_t size);
+
+    // Key of the result of an image with the given pixels and size under the given settings.
+    static std::string makeKey(const unsigned char* pixels, uint32_t width, uint32_t height, const std::string& settings);
+
+    // Finds a result in memory or on disk. inputBytes is what the job would have uploaded, for the statistics.
+    bool lookup(const std::string& key, uint64_t inputBytes, std::shared_ptr<const std::vector<unsigned char>>& file);
+
+    void store(const std::string& key, std::shared_ptr<const std::vector<unsigned char>> file);
+
+    ResultCacheStats stats();
+};
+
+// Writes a file under a temporary name unique to this process and thread first, then renames it over
+// path, so readers see the old file or the new one, never half of one. Returns false if it failed.
+// Also used for the pipeline cache and the workgroup profile.
+bool writeFileReplacing(const std::string& path, const void* data, size_t size);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/*
+Fixed set of worker threads for data parallel loops. parallelFor() splits a range into chunks,
+runs them on the workers and the calling thread, and returns once every chunk is done.
+*/
+class ThreadPool {
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+
+    //bumped for every parallelFor(), so sleeping workers know there is new work
+    uint64_t generation = 0;
+    size_t busyWorkers = 0;
+
+    //the current loop
+    const std::function<void(size_t, size_t)>* task = NULL;
+    size_t taskCount = 0;
+    size_t chunkSize = 1;
+    std::atomic<size_t> nextChunk;
+
+    //only one loop runs at a time
+    std::mutex callMutex;
+
+    void workerLoop();
+    void runChunks();
+
+public:
+
+    // 0 threads uses one thread per hardware thread.
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads working on a loop, including the calling thread.
+    size_t size() const;
+
+    // Calls task(begin, end) for chunks covering [0, count).
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& task);
+};
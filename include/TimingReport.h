@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <stdint.h>
+
+//Time in ms each stage took for one image. Stages starting with gpu_ come from
+//timestamp queries, all others are host timers.
+struct ImageTimings {
+    std::string image;
+    std::string kernel;     //blur mode that actually ran
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<std::pair<std::string, double> > stages;
+
+    void add(const std::string& stage, double ms);
+};
+
+/*
+Collects the timings of every processed image and writes them as JSON or CSV.
+add() can be called from several threads.
+*/
+class TimingReport {
+
+    std::mutex mutex;
+    std::vector<ImageTimings> images;
+
+public:
+
+    void add(const ImageTimings& timings);
+
+    // One object per image, with the stages as a name -> ms object.
+    void writeJson(const std::string& filename);
+
+    // One row per image and stage: image,kernel,width,height,stage,ms
+    void writeCsv(const std::string& filename);
+
+    // Picks the format from the file extension, JSON unless it ends in .csv.
+    void write(const std::string& filename);
+};
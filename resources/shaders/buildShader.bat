@@ -1 +1,10 @@
-glslangValidator -V shader.comp
\ No newline at end of file
+glslangValidator -V shader.comp -o shader.spv
+glslangValidator -V blurHorizontal.comp -o blurHorizontal.spv
+glslangValidator -V blurVertical.comp -o blurVertical.spv
+glslangValidator -V blurHorizontalTiled.comp -o blurHorizontalTiled.spv
+glslangValidator -V blurVerticalTiled.comp -o blurVerticalTiled.spv
+glslangValidator -V boxHorizontal.comp -o boxHorizontal.spv
+glslangValidator -V boxVertical.comp -o boxVertical.spv
+glslangValidator -V graph.comp -o graph.spv
+glslangValidator -V blurVerticalRetained.comp -o blurVerticalRetained.spv
+glslangValidator -V finalColor.comp -o finalColor.spv
@@ -0,0 +1,237 @@
+//Declarations shared by all compute shaders.
+//Included with GL_GOOGLE_include_directive, which glslangValidator supports by default.
+
+#define 	PI 	3.14159265358979323846
+#define 	E	2.7182818284
+
+#define 	WORKGROUP_SIZE 	32
+
+//tiled kernels: a workgroup covers TILE_LENGTH pixels along the blur direction
+//and TILE_WIDTH pixels across it. Must match ComputeApplication.h.
+#define 	TILE_LENGTH 	64
+#define 	TILE_WIDTH 	4
+#define 	MAX_TILED_RADIUS 	64
+
+//box blur kernels: invocations per workgroup, each walks a segment of one row or column
+#define 	BOX_GROUP_SIZE 	64
+
+//filter graph passes, see FilterGraph.h. Per pixel operations, must match FilterOpType.
+#define 	GRAPH_OP_TINT 	1
+#define 	GRAPH_OP_SATURATION 	2
+#define 	GRAPH_OP_BRIGHTNESS_CONTRAST 	3
+#define 	GRAPH_OP_LUT 	4
+
+//what a pass reads around each pixel, must match FilterStencil
+#define 	GRAPH_STENCIL_NONE 	0
+#define 	GRAPH_STENCIL_BLUR_HORIZONTAL 	1
+#define 	GRAPH_STENCIL_BLUR_VERTICAL 	2
+#define 	GRAPH_STENCIL_SHARPEN 	3
+#define 	GRAPH_STENCIL_RESIZE 	4
+
+//buffers a pass reads and writes, the passes in between ping-pong between the two float buffers
+#define 	GRAPH_BUFFER_INPUT 	0
+#define 	GRAPH_BUFFER_A 	1	//intermediateImageData
+#define 	GRAPH_BUFFER_B 	2	//boxImageData
+#define 	GRAPH_BUFFER_OUTPUT 	3
+
+//storage format of the input and output images, see PixelFormat in ComputeApplication.h.
+//Set per pipeline with a specialization constant, so the branches below fold away.
+#define 	PIXEL_FORMAT_RGBA32F 	0	//4 floats per pixel
+#define 	PIXEL_FORMAT_RGBA8 	1	//4 bytes packed in one uint
+#define 	PIXEL_FORMAT_RGBA16F 	2	//4 halfs packed in two uints
+
+layout(constant_id = 0) const uint PIXEL_FORMAT = PIXEL_FORMAT_RGBA32F;
+
+//blur window size baked into a pipeline variant for common sizes, 0 for the generic kernel
+//that reads job.blur. With a constant window the tap loops can be fully unrolled.
+layout(constant_id = 1) const int BLUR_SIZE = 0;
+
+//workgroup size of the non tiled kernels, constant ids of local_size_x_id and local_size_y_id
+#define 	WORKGROUP_SIZE_X_ID 	2
+#define 	WORKGROUP_SIZE_Y_ID 	3
+
+struct Color{
+  vec4 value;
+};
+
+layout(std430, binding = 0) readonly buffer buf
+{
+   uint inputImageData[];
+};
+
+//per job settings, pushed into the command buffer with vkCmdPushConstants
+layout(push_constant) uniform PushConstants
+{
+  
+	vec4 color;
+
+	uint width;
+	uint height;
+	float saturation;
+	int blur;
+
+	//only read by the box blur passes, pushed again before each pass
+	int boxRadius;
+	uint boxPass;
+	uint boxSegment;
+
+	//only read by the filter graph passes, pushed again before each pass.
+	//width and height are the size the pass writes, these the size it reads.
+	uint sourceWidth;
+	uint sourceHeight;
+	uint graphSource;
+	uint graphTarget;
+	uint graphStencil;
+	float graphAmount;
+
+	//in vec4s of graphData
+	uint graphOpStart;
+	uint graphOpCount;
+	uint graphWeightStart;
+
+	//pixel the first invocation of the separable passes works on, only processIncremental()
+	//dispatches them over part of the image
+	uint regionX;
+	uint regionY;
+
+}job;
+
+layout(std430, binding = 2) writeonly buffer buf2
+{
+   uint outputImageData[];
+};
+
+//holds the result of the horizontal pass of the separable blur, always full floats
+layout(std140, binding = 3) buffer buf3
+{
+   Color intermediateImageData[];
+};
+
+//second float buffer of the box blur, its stacked passes alternate between this and the intermediate buffer.
+//processIncremental() keeps the blurred image in it, before tint and saturation.
+layout(std140, binding = 5) buffer buf5
+{
+   Color boxImageData[];
+};
+
+//normalized 1D gaussian for the current blur size, built once on the host.
+//gaussWeights[i] is the weight of the tap at offset i - radius.
+layout(std430, binding = 4) readonly buffer buf4
+{
+   float gaussWeights[];
+};
+
+//operations and blur weights of the filter graph passes, written by the host for each graph.
+//Every operation is a header (code, vec4s of extra data) and its values, a LUT is followed by its
+//256 entries. The gaussian weights of a blur pass are packed four to a vec4.
+layout(std430, binding = 6) readonly buffer buf6
+{
+   vec4 graphData[];
+};
+
+//pixel values are in the 0 - 255 range whatever the storage format
+vec4 loadInputPixel(uint index){
+
+	if (PIXEL_FORMAT == PIXEL_FORMAT_RGBA8) {
+		return unpackUnorm4x8(inputImageData[index]) * 255.0;
+	}
+	if (PIXEL_FORMAT == PIXEL_FORMAT_RGBA16F) {
+		return vec4(unpackHalf2x16(inputImageData[2 * index]), unpackHalf2x16(inputImageData[2 * index + 1]));
+	}
+	return uintBitsToFloat(uvec4(inputImageData[4 * index], inputImageData[4 * index + 1],
+		inputImageData[4 * index + 2], inputImageData[4 * index + 3]));
+}
+
+void storeOutputPixel(uint index, vec4 value){
+
+	if (PIXEL_FORMAT == PIXEL_FORMAT_RGBA8) {
+		outputImageData[index] = packUnorm4x8(value / 255.0);
+	}
+	else if (PIXEL_FORMAT == PIXEL_FORMAT_RGBA16F) {
+		outputImageData[2 * index] = packHalf2x16(value.rg);
+		outputImageData[2 * index + 1] = packHalf2x16(value.ba);
+	}
+	else {
+		uvec4 bits = floatBitsToUint(value);
+		outputImageData[4 * index] = bits.r;
+		outputImageData[4 * index + 1] = bits.g;
+		outputImageData[4 * index + 2] = bits.b;
+		outputImageData[4 * index + 3] = bits.a;
+	}
+}
+
+vec4 lerp(vec4 first, vec4 second, float param){
+	return (1.0 - param) * first + param * second;
+}
+
+vec4 clamp_0_255(vec4 raw){
+	vec4 retVal = raw;
+
+	if(retVal.r > 255)	retVal.r = 255;
+	if(retVal.r < 0) retVal.r = 0;
+	if(retVal.g > 255)	retVal.g = 255;
+	if(retVal.g < 0) retVal.g = 0;
+	if(retVal.b > 255)	retVal.b = 255;
+	if(retVal.b < 0) retVal.b = 0;
+	if(retVal.a > 255)	retVal.a = 255;
+	if(retVal.a < 0) retVal.a = 0;
+
+	return retVal;
+}
+
+//only used by the reference kernel, the separable passes read gaussWeights instead
+float gaussKernel(int x, int n) {
+
+	float sigma = floor(n / 2.0) / 2.0;
+	float base = 1.0 / (sqrt(2.0 * PI) * sigma);
+	float exp = -(x * x) / (2.0 * sigma * sigma);
+	return base * pow(E, exp);
+}
+
+//blur window size must be odd and at least 3
+int blurWindowSize(){
+
+	//already checked on the host
+	if (BLUR_SIZE > 0) {
+		return BLUR_SIZE;
+	}
+
+	int n = job.blur;
+
+	//error check
+	if (n < 3) {
+		n = 3;
+	}
+	if (n % 2 == 0) {
+		n += 1;
+	}
+	return n;
+}
+
+//wrap a coordinate around the image edge, also for windows wider than the image
+int wrapCoordinate(int i, uint size) {
+
+	int s = int(size);
+	i = i % s;
+	if (i < 0) { i += s; }
+	return i;
+}
+
+vec4 GetPixelWrapped(int x, int y) {
+
+	x = wrapCoordinate(x, job.width);
+	y = wrapCoordinate(y, job.height);
+	return loadInputPixel(job.width * y + x);
+}
+
+vec4 saturate(vec4 raw, float saturation){
+
+	float averageLum = (raw.r + raw.g + raw.b) / 3.0f;
+	vec4 grayScale = vec4(averageLum, averageLum, averageLum, raw.a);
+	return lerp(grayScale, raw, saturation);
+}
+
+//tint, saturation and 0 - 255 bounds applied to every blurred pixel
+vec4 finalColor(vec4 blurred){
+	return clamp_0_255(saturate(job.color * blurred, job.saturation));
+}
@@ -1,19 +1,45 @@
 #include "../include/ComputeApplication.h"
+#include "../include/CpuEngine.h"
+#include "../include/PngWriter.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COMPUTE_APPLICATION_SSE
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Decoded images of a MB or more start on a page boundary, so the decoder's buffer can be
+// imported with VK_EXT_external_memory_host. Smaller ones are not worth a page of padding.
+static void* pageAlignedMalloc(size_t size) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    void* pointer = NULL;
+    if (size >= 1024 * 1024 && pageSize > 0 && posix_memalign(&pointer, (size_t)pageSize, size) == 0) {
+        return pointer;
+    }
+    return malloc(size);
+}
+#define STBI_MALLOC(size) pageAlignedMalloc(size)
+#define STBI_REALLOC(pointer, size) realloc(pointer, size)
+#define STBI_FREE(pointer) free(pointer)
+#endif
 
 #ifndef STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #endif
 
-#ifndef STB_IMAGE_WRITE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image_write.h>
-#endif
-
 #include <fstream>
-
-uint32_t ComputeApplication::OUTPUT_WIDTH = -1;
-uint32_t ComputeApplication::OUTPUT_HEIGHT = -1;
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <stddef.h>
 
 // Used for validating return values of Vulkan API calls.
 #define VK_CHECK_RESULT(f)                                                                              \
@@ -30,108 +56,1539 @@ struct Color {
 	float r, g, b, a;
 };
 
-struct UniformBufferObject{
-    
+// Truncates float channels to bytes like an (unsigned char) cast, values outside 0-255 saturate.
+// With SSE 4 pixels are converted per iteration.
+static void floatsToBytes(const float* input, unsigned char* output, size_t count) {
+
+    size_t i = 0;
+#ifdef COMPUTE_APPLICATION_SSE
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_cvttps_epi32(_mm_loadu_ps(input + i));
+        __m128i b = _mm_cvttps_epi32(_mm_loadu_ps(input + i + 4));
+        __m128i c = _mm_cvttps_epi32(_mm_loadu_ps(input + i + 8));
+        __m128i d = _mm_cvttps_epi32(_mm_loadu_ps(input + i + 12));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*)(output + i), bytes);
+    }
+#endif
+    for (; i < count; ++i) {
+        output[i] = (unsigned char)min(max(input[i], 0.0f), 255.0f);
+    }
+}
+
+// Written in front of the VkPipelineCache data in the cache file. The driver only checks the
+// vendor, device and cache UUID, so the driver version is checked here as well.
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    double coldCreationTime;    //ms spent creating pipelines when the cache was first filled
+};
+
+static const uint32_t PIPELINE_CACHE_MAGIC = 0x43505056; //"VPPC"
+
+// Work handed between the threads of processBatch().
+struct DecodedJob {
+    size_t index;       //into the job list
+    Image image;
+    double decodeTime;  //ms
+    std::string cacheKey;   //empty without a result cache
+};
+
+struct EncodeJob {
+    Image image;
+    std::string output;
+    ImageTimings timings;
+    std::string cacheKey;   //stores the encoded file under this key, if set
+    std::shared_ptr<const std::vector<unsigned char>> cachedFile;  //written instead of encoding image, if set
+};
+
+// Part of a large image, processed on its own with a halo of blur radius pixels around it.
+struct TileRect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Wraps like wrapCoordinate() in common.glsl.
+static int32_t wrapCoordinate(int64_t i, uint32_t size) {
+    int64_t wrapped = i % (int64_t)size;
+    return (int32_t)(wrapped < 0 ? wrapped + size : wrapped);
+}
+
+// Copies a tile and its halo out of the image. The halo wraps around the image edges,
+// so the tile sees exactly the pixels GetPixelWrapped() would read on the whole image.
+static Image gatherTile(const Image& image, const TileRect& tile, int32_t radius) {
+
+    Image tileImage;
+    tileImage.width = tile.width + 2 * radius;
+    tileImage.height = tile.height + 2 * radius;
+    tileImage.pixels.resize((size_t)tileImage.width * tileImage.height * 4);
+
+    for (uint32_t y = 0; y < tileImage.height; ++y) {
+        int32_t sourceY = wrapCoordinate((int64_t)tile.y - radius + y, image.height);
+        const unsigned char* sourceRow = image.data() + (size_t)sourceY * image.width * 4;
+        unsigned char* destination = &tileImage.pixels[(size_t)y * tileImage.width * 4];
+
+        //at most three runs per row: wrapped left edge, inside, wrapped right edge
+        int64_t sourceX = (int64_t)tile.x - radius;
+        uint32_t remaining = tileImage.width;
+        while (remaining > 0) {
+            uint32_t start = (uint32_t)wrapCoordinate(sourceX, image.width);
+            uint32_t count = min(remaining, image.width - start);
+            memcpy(destination, sourceRow + (size_t)start * 4, (size_t)count * 4);
+            destination += (size_t)count * 4;
+            sourceX += count;
+            remaining -= count;
+        }
+    }
+    return tileImage;
+}
+
+// Sums the stages of one tile into the timings of the whole image.
+static void accumulateTimings(ImageTimings& total, const ImageTimings& tile) {
+    for (size_t i = 0; i < tile.stages.size(); ++i) {
+        size_t j = 0;
+        while (j < total.stages.size() && total.stages[j].first != tile.stages[i].first) {
+            ++j;
+        }
+        if (j == total.stages.size()) {
+            total.stages.push_back(tile.stages[i]);
+        }
+        else {
+            total.stages[j].second += tile.stages[i].second;
+        }
+    }
+}
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void writeFile(const std::string& filename, const std::vector<unsigned char>& contents) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.write((const char*)contents.data(), contents.size())) {
+        throw std::runtime_error("Compute Application::saveImage: failed to write " + filename);
+    }
+}
+
+//Per job settings, pushed into the command buffer. Same layout as PushConstants in common.glsl,
+//88 bytes, inside the 128 every device supports.
+struct PushConstants {
+
 	Color color;
 
     uint32_t width;
     uint32_t height;
     float saturation;
     int32_t blur;
+
+    //only read by the box blur passes, pushed again before each pass
+    int32_t boxRadius;
+    uint32_t boxPass;
+    uint32_t boxSegment;
+
+    //only read by the filter graph passes, pushed again before each pass
+    uint32_t sourceWidth;
+    uint32_t sourceHeight;
+    uint32_t graphSource;
+    uint32_t graphTarget;
+    uint32_t graphStencil;
+    float graphAmount;
+    uint32_t graphOpStart;
+    uint32_t graphOpCount;
+    uint32_t graphWeightStart;
+
+    //only set by processIncremental(), which blurs parts of the image
+    uint32_t regionX;
+    uint32_t regionY;
 };
 
-void ComputeApplication::run() {
+//Buffers the filter graph passes read and write. Must match the GRAPH_BUFFER defines in common.glsl.
+enum GraphBuffer {
+    GRAPH_BUFFER_INPUT,
+    GRAPH_BUFFER_A,         //the intermediate buffer
+    GRAPH_BUFFER_B,         //the box buffer
+    GRAPH_BUFFER_OUTPUT
+};
+
+// IEEE half conversions for PIXEL_FORMAT_RGBA16F. Pixel values are 0 - 255, so
+// denormals are flushed to zero and the mantissa is truncated.
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0) {
+        return sign;
+    }
+    if (exponent >= 31) {
+        return sign | 0x7c00;
+    }
+    return sign | (uint16_t)(exponent << 10) | (uint16_t)(mantissa >> 13);
+}
+
+static float halfToFloat(uint16_t value) {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0) {
+        bits = sign;
+    }
+    else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Same window size correction as blurWindowSize() in common.glsl: odd and at least 3.
+static int32_t blurWindowSize(int32_t blur) {
+    int32_t n = blur;
+    if (n < 3) {
+        n = 3;
+    }
+    if (n % 2 == 0) {
+        n += 1;
+    }
+    return n;
+}
+
+void ComputeApplication::init() {
 
 
     // Initialize vulkan
     createInstance();
     findPhysicalDevice();
     createDevice();
-    
-    //also sets the width and height
-    loadImage();
-
-
-    //create and init buffer resources on GPU
-    createInputBuffer();
-    writeToInputBuffer();
-    createUniformBuffer();
-    writeToUniformBuffer();
-	createOutputBuffer();
-	
+    allocator.init(physicalDevice, device);
+    detectUnifiedMemory();
+
+    //Every frame gets its own weight table, so a job can be written while the previous ones
+    //are still running. Image buffers are created by the first job of a frame.
+    //The weight table starts out large enough for every radius the tiled blur supports.
+    frames.resize(framesInFlight);
+    for (size_t i = 0; i < frames.size(); ++i) {
+        createWeightBuffer(frames[i], sizeof(float) * (2 * MAX_TILED_RADIUS + 1));
+    }
 
     //create descriptor resources
     createDescriptorSetLayout();
     createDescriptorSet();
 
-    
-    //create pipeline
-    createComputePipeline();
-    
+    //pipelines themselves are compiled the first time a job needs them,
+    //from the cache file of the last run if there is one
+    createPipelineLayout();
+    createPipelineCache();
+
+    //workgroup size autotune() picked for this device in an earlier run
+    loadWorkgroupProfile();
 
-    //record command buffer
+    //command buffers and fences are reused by every job
     createCommandBuffer();
 
-    
-    // Finally, run the recorded command buffer.
-    runCommandBuffer();
-    
-    
-    // Save that buffer as a png on disk.
-    saveRenderedImage();
+    //GPU timing of every recorded stage
+    createTimestampQueries();
+}
+
+Image ComputeApplication::process(const Image& input, const FilterParams& params) {
+
+    //images that do not fit one set of buffers are split up, from all of their pixels
+    if (needsTiling(input)) {
+        if (!input.decoded()) {
+            Image decodedInput = input;
+            decodeImage(decodedInput);
+            return processTiled(decodedInput, params);
+        }
+        return processTiled(input, params);
+    }
+
+    //single jobs always use the first frame
+    Frame& frame = frames[0];
+
+    prepareFrame(frame, input, params);
+    auto submitTime = std::chrono::high_resolution_clock::now();
+    submitFrame(frame);
+    waitForFrame(frame);
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - submitTime;
+    if (verbose) {
+        cout << blurModeName(frame.activeBlurMode) << " blur took " << elapsed.count() << " ms" << endl;
+    }
+
+    // Read the result back into host memory.
+    Image output;
+    auto readStart = std::chrono::high_resolution_clock::now();
+    readFromOutputBuffer(frame, output);
+    frame.timings.add("read_output", millisecondsSince(readStart));
+    return output;
+}
+
+// The pixels within dx columns and dy rows of a rectangle. The blur wraps around the image edges,
+// so a rectangle that grows past an edge covers the whole width or height instead.
+static ImageRect growRect(const ImageRect& rect, uint32_t dx, uint32_t dy, uint32_t width, uint32_t height) {
 
-    // Clean up all Vulkan resources.
-    cleanup();
+    ImageRect grown = rect;
+    if (rect.x < dx || (uint64_t)rect.x + rect.width + dx > width) {
+        grown.x = 0;
+        grown.width = width;
+    }
+    else {
+        grown.x -= dx;
+        grown.width += 2 * dx;
+    }
+    if (rect.y < dy || (uint64_t)rect.y + rect.height + dy > height) {
+        grown.y = 0;
+        grown.height = height;
+    }
+    else {
+        grown.y -= dy;
+        grown.height += 2 * dy;
+    }
+    return grown;
 }
 
-void ComputeApplication::loadImage(){
+Image ComputeApplication::processIncremental(const Image& input, const FilterParams& params, const ImageRect& changed) {
+
+    //the graph passes and the tiles have nowhere to keep the blur, the next call starts over. Only the
+    //separable blur is kept. The tiled one computes the same gaussian, the box blur only approximates it,
+    //and jobs that ask for the reference kernel get it
+    if (params.graph || needsTiling(input) || usesBoxBlur(params) || params.blurMode == BLUR_MODE_REFERENCE) {
+        editBlur = 0;
+        return process(input, params);
+    }
+    if (!changed.empty() && ((uint64_t)changed.x + changed.width > input.width || (uint64_t)changed.y + changed.height > input.height)) {
+        throw std::runtime_error("Compute Application::processIncremental: the changed rectangle is outside of the image");
+    }
+    if (!editFrameCreated) {
+        createEditFrame();
+    }
+
+    Frame& frame = editFrame;
+    int32_t windowSize = blurWindowSize(params.blur);
+    uint32_t radius = (uint32_t)(windowSize / 2);
+
+    //a blur of another image size or window size is of no use
+    bool keepBlur = editBlur == windowSize && frame.imageWidth == input.width && frame.imageHeight == input.height;
+
+    frame.imageWidth = input.width;
+    frame.imageHeight = input.height;
+    frame.outputWidth = input.width;
+    frame.outputHeight = input.height;
+    frame.imageSize = (VkDeviceSize)bytesPerPixel(pixelFormat) * frame.imageWidth * frame.imageHeight;
+    frame.intermediateSize = (VkDeviceSize)sizeof(Color) * frame.imageWidth * frame.imageHeight;
+    frame.activeBlurMode = BLUR_MODE_SEPARABLE;
+    frame.timings = ImageTimings();
+    frame.timings.width = input.width;
+    frame.timings.height = input.height;
+    frame.timings.kernel = "incremental";
+
+    //new buffers start out empty, the box buffer keeps the blurred image
+    VkDeviceSize imageCapacity = frame.imageCapacity;
+    reserveImageBuffers(frame);
+    reserveBoxBuffer(frame);
+    if (frame.imageCapacity != imageCapacity) {
+        keepBlur = false;
+    }
+    editBlur = 0;
+
+    /*
+    Rows of the input that changed are uploaded again. The horizontal pass writes a pixel from the
+    radius pixels left and right of it, so it only has to run radius columns around the changed
+    pixels. The vertical pass reads radius rows above and below, in the columns the horizontal pass
+    wrote, so it runs radius rows and columns around them. Everything else in the intermediate and
+    box buffers is still what the last call wrote.
+    */
+    ImageRect whole;
+    whole.width = input.width;
+    whole.height = input.height;
+    ImageRect upload;
+    ImageRect horizontal;
+    ImageRect vertical;
+    if (!keepBlur) {
+        upload = whole;
+        horizontal = whole;
+        vertical = whole;
+    }
+    else if (!changed.empty()) {
+        upload.y = changed.y;
+        upload.width = input.width;
+        upload.height = changed.height;
+        horizontal = growRect(changed, radius, 0, input.width, input.height);
+        vertical = growRect(changed, radius, radius, input.width, input.height);
+    }
+
+    auto writeStart = std::chrono::high_resolution_clock::now();
+    if (!upload.empty()) {
+        writeToInputBuffer(frame, input, upload.y, upload.height);
+        frame.timings.add("write_input", millisecondsSince(writeStart));
+    }
+    writeToWeightBuffer(frame, params.blur);
+
+    auto recordStart = std::chrono::high_resolution_clock::now();
+    recordIncremental(frame, params, upload, horizontal, vertical);
+    frame.timings.add("record", millisecondsSince(recordStart));
+
+    auto submitTime = std::chrono::high_resolution_clock::now();
+    submitFrame(frame);
+    waitForFrame(frame);
+    editBlur = windowSize;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - submitTime;
+    if (verbose) {
+        cout << "incremental " << (horizontal.empty() ? "tint and saturation" : "blur") << " took " << elapsed.count() << " ms" << endl;
+    }
+
+    Image output;
+    auto readStart = std::chrono::high_resolution_clock::now();
+    readFromOutputBuffer(frame, output);
+    frame.timings.add("read_output", millisecondsSince(readStart));
+
+    //lastTimings() reports the first frame
+    frames[0].timings = frame.timings;
+    return output;
+}
+
+bool ComputeApplication::needsTiling(const Image& input) const {
+
+    //the intermediate buffer is the largest one, 4 floats per pixel in every pixel format
+    VkDeviceSize intermediateSize = (VkDeviceSize)sizeof(Color) * input.width * input.height;
+    if (intermediateSize > maxTileBytes()) {
+        return true;
+    }
+
+    //the tiled kernels cover the fewest pixels per workgroup, TILE_WIDTH across the blur direction
+    const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+    return (input.width + TILE_WIDTH - 1) / TILE_WIDTH > limits.maxComputeWorkGroupCount[0] ||
+        (input.height + TILE_WIDTH - 1) / TILE_WIDTH > limits.maxComputeWorkGroupCount[1];
+}
+
+VkDeviceSize ComputeApplication::maxTileBytes() const {
+
+    //a storage buffer descriptor can not address more than maxStorageBufferRange bytes
+    VkDeviceSize budget = deviceProperties.limits.maxStorageBufferRange;
+    if (tileMemoryBudget != 0) {
+        budget = min(budget, tileMemoryBudget);
+    }
+    return budget;
+}
+
+uint64_t ComputeApplication::maxImagePixels() const {
+
+    //the intermediate buffer is the largest one, 4 floats per pixel
+    return maxTileBytes() / sizeof(Color);
+}
+
+Image ComputeApplication::processTiled(const Image& input, const FilterParams& params) {
+
+    /*
+    The image is cut into square tiles. Each tile is uploaded together with a halo of blur radius
+    pixels on every side, so the blur of the pixels inside the tile only reads pixels of the upload.
+    Only the inside is copied back, and the tiles rotate through the frames, so the next tile is
+    gathered and uploaded while the GPU works on the previous one. Device memory stays the same
+    however large the image is.
+    */
+    int32_t radius = blurWindowSize(params.blur) / 2;
+
+    //the stacked box passes reach further than the gaussian window
+    if (usesBoxBlur(params)) {
+        int32_t radii[3];
+        computeBoxRadii(params.blur, radii);
+        radius = max(radius, radii[0] + radii[1] + radii[2]);
+    }
+
+    //a graph reads as far as its stencils together, tiles of a resized image would not line up
+    if (params.graph) {
+        if (params.graph->resizes()) {
+            throw std::runtime_error("filter graphs that resize can not process images in tiles");
+        }
+        radius = params.graph->reach();
+    }
+
+    //largest square tile whose intermediate buffer, halo included, fits the budget
+    uint64_t maxPixels = maxTileBytes() / sizeof(Color);
+    int64_t tileSize = (int64_t)sqrt((double)maxPixels) - 2 * radius;
+    tileSize = min(tileSize, (int64_t)deviceProperties.limits.maxComputeWorkGroupCount[0] * TILE_WIDTH - 2 * radius);
+    tileSize = min(tileSize, (int64_t)deviceProperties.limits.maxComputeWorkGroupCount[1] * TILE_WIDTH - 2 * radius);
+    tileSize -= tileSize % TILE_LENGTH;
+    if (tileSize <= 0) {
+        throw std::runtime_error("blur radius " + std::to_string(radius) + " is too large for the tile memory budget");
+    }
+
+    std::vector<TileRect> tiles;
+    for (uint32_t y = 0; y < input.height; y += (uint32_t)tileSize) {
+        for (uint32_t x = 0; x < input.width; x += (uint32_t)tileSize) {
+            TileRect tile = { x, y, min((uint32_t)tileSize, input.width - x), min((uint32_t)tileSize, input.height - y) };
+            tiles.push_back(tile);
+        }
+    }
+
+    if (verbose) {
+        cout << "processing " << input.width << "x" << input.height << " in " << tiles.size() << " tiles of "
+            << tileSize << "x" << tileSize << " with a " << radius << " pixel halo" << endl;
+    }
+
+    Image output;
+    output.width = input.width;
+    output.height = input.height;
+    output.pixels.resize((size_t)input.width * input.height * 4);
+
+    ImageTimings timings;
+    timings.width = input.width;
+    timings.height = input.height;
+
+    //copies the inside of a finished tile into the output
+    auto retireTile = [&](Frame& frame) {
+        const TileRect& tile = tiles[frame.jobIndex];
+        waitForFrame(frame);
+
+        Image tileOutput;
+        auto readStart = std::chrono::high_resolution_clock::now();
+        readFromOutputBuffer(frame, tileOutput);
+        for (uint32_t y = 0; y < tile.height; ++y) {
+            memcpy(&output.pixels[((size_t)(tile.y + y) * output.width + tile.x) * 4],
+                &tileOutput.pixels[((size_t)(y + radius) * tileOutput.width + radius) * 4], (size_t)tile.width * 4);
+        }
+        frame.timings.add("read_output", millisecondsSince(readStart));
+
+        timings.kernel = frame.timings.kernel;
+        accumulateTimings(timings, frame.timings);
+    };
+
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        Frame& frame = frames[i % frames.size()];
+        if (frame.inFlight) {
+            retireTile(frame);
+        }
+
+        auto gatherStart = std::chrono::high_resolution_clock::now();
+        Image tileInput = gatherTile(input, tiles[i], radius);
+        double gatherTime = millisecondsSince(gatherStart);
+
+        prepareFrame(frame, tileInput, params);
+        frame.timings.add("gather_tile", gatherTime);
+        frame.jobIndex = i;
+        submitFrame(frame);
+    }
+
+    //oldest first
+    for (size_t i = 0; i < frames.size(); ++i) {
+        Frame& frame = frames[(tiles.size() + i) % frames.size()];
+        if (frame.inFlight) {
+            retireTile(frame);
+        }
+    }
+
+    //report the whole image as the last job
+    frames[0].timings = timings;
+    return output;
+}
+
+void ComputeApplication::processFile(const BatchJob& job, const FilterParams& params) {
+
+    auto decodeStart = std::chrono::high_resolution_clock::now();
+    Image input = loadImage(job.input);
+    double decodeTime = millisecondsSince(decodeStart);
+    if (verbose) {
+        cout << "loaded " << job.input << ", " << input.width << "x" << input.height << endl;
+    }
+
+    //the same pixels with the same settings wrote this file before
+    std::string cacheKey;
+    double hashTime = 0.0;
+    if (resultCache != NULL) {
+        auto hashStart = std::chrono::high_resolution_clock::now();
+        cacheKey = ResultCache::makeKey(input.data(), input.width, input.height, resultSettings(params, job.output));
+        hashTime = millisecondsSince(hashStart);
+
+        std::shared_ptr<const std::vector<unsigned char>> cached;
+        VkDeviceSize inputBytes = (VkDeviceSize)bytesPerPixel(pixelFormat) * input.width * input.height;
+        if (resultCache->lookup(cacheKey, inputBytes, cached)) {
+            auto writeStart = std::chrono::high_resolution_clock::now();
+            writeFile(job.output, *cached);
+            if (timingReport != NULL) {
+                ImageTimings timings;
+                timings.image = job.input;
+                timings.kernel = "cache";
+                timings.width = input.width;
+                timings.height = input.height;
+                timings.add("decode", decodeTime);
+                timings.add("hash", hashTime);
+                timings.add("encode", millisecondsSince(writeStart));
+                timingReport->add(timings);
+            }
+            return;
+        }
+    }
+
+    Image output = process(input, params);
+
+    auto encodeStart = std::chrono::high_resolution_clock::now();
+    if (resultCache != NULL) {
+        std::shared_ptr<std::vector<unsigned char>> file = std::make_shared<std::vector<unsigned char>>(encodeImage(output, job.output, pngCompressionLevel));
+        writeFile(job.output, *file);
+        resultCache->store(cacheKey, file);
+    }
+    else {
+        saveImage(output, job.output, pngCompressionLevel);
+    }
+    double encodeTime = millisecondsSince(encodeStart);
+
+    if (timingReport != NULL) {
+        ImageTimings& timings = frames[0].timings;
+        timings.image = job.input;
+        timings.stages.insert(timings.stages.begin(), std::make_pair(std::string("decode"), decodeTime));
+        if (resultCache != NULL) {
+            timings.add("hash", hashTime);
+        }
+        timings.add("encode", encodeTime);
+        timingReport->add(timings);
+    }
+}
+
+BatchStats ComputeApplication::processBatch(const std::vector<BatchJob>& jobs, const FilterParams& params) {
+
+    /*
+    Four stages work on different images at the same time:
+    the decode threads load images k+2 and later, this thread uploads image k+1 and records its commands,
+    the GPU runs image k and the encode thread writes image k-1.
+    Formats that can be decoded a few rows at a time are only opened by the decode threads, their rows
+    are decoded straight into the input buffer during the upload, while the GPU runs the previous images.
+    The queues between the threads hold at most one image per frame, so memory stays bounded.
+    With a CPU co-processor, another thread takes decoded images from the same queue,
+    so each side gets as many images as it manages to process.
+    */
+    typedef std::chrono::high_resolution_clock Clock;
+    typedef std::chrono::duration<double> Seconds;
+
+    BlockingQueue<DecodedJob> decoded(frames.size());
+    BlockingQueue<EncodeJob> encoded(frames.size());
+
+    BatchStats stats;
+    std::string decodeError;
+    std::string encodeError;
+
+    //guards decodeError, the decode statistics, which every decode thread and this thread add to, and their output
+    std::mutex decodeMutex;
+    auto addDecodeTime = [&](const Image& image, double ms, bool newImage) {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        BatchStats::FormatStats& format = stats.decodeFormats[image.format];
+        if (newImage) {
+            format.images += 1;
+            format.megapixels += (double)image.width * image.height / 1e6;
+        }
+        format.seconds += ms / 1000.0;
+        stats.decodeTime += ms / 1000.0;
+    };
+
+    //the CPU engine, the tiled path and the result cache need all pixels up front
+    auto decodeRemainingRows = [&](DecodedJob& job) {
+        if (!job.image.decoded()) {
+            auto start = Clock::now();
+            decodeImage(job.image);
+            double ms = millisecondsSince(start);
+            job.decodeTime += ms;
+            addDecodeTime(job.image, ms, false);
+        }
+    };
+
+    //with a result cache, the decode threads write the results found in it right away, the
+    //other jobs carry their key along to store their result once it is encoded
+    auto findCachedResult = [&](DecodedJob& job) {
+        decodeRemainingRows(job);
+        auto hashStart = Clock::now();
+        job.cacheKey = ResultCache::makeKey(job.image.data(), job.image.width, job.image.height, resultSettings(params, jobs[job.index].output));
+        double hashTime = millisecondsSince(hashStart);
+
+        EncodeJob encodeJob;
+        VkDeviceSize inputBytes = (VkDeviceSize)bytesPerPixel(pixelFormat) * job.image.width * job.image.height;
+        if (!resultCache->lookup(job.cacheKey, inputBytes, encodeJob.cachedFile)) {
+            return false;
+        }
+        encodeJob.output = jobs[job.index].output;
+        encodeJob.timings.image = jobs[job.index].input;
+        encodeJob.timings.kernel = "cache";
+        encodeJob.timings.width = job.image.width;
+        encodeJob.timings.height = job.image.height;
+        encodeJob.timings.add("decode", job.decodeTime);
+        encodeJob.timings.add("hash", hashTime);
+        {
+            std::lock_guard<std::mutex> lock(decodeMutex);
+            ++stats.cachedImages;
+        }
+        encoded.push(std::move(encodeJob));
+        return true;
+    };
+
+    auto batchStart = Clock::now();
+
+    //each decode thread takes the next job, the last one to finish closes the queue
+    size_t decodeThreadCount = max((size_t)1, min(frames.size(), (size_t)std::thread::hardware_concurrency() / 2));
+    std::atomic<size_t> nextDecode(0);
+    std::atomic<size_t> runningDecoders(decodeThreadCount);
+    std::vector<std::thread> decodeThreads;
+    for (size_t t = 0; t < decodeThreadCount; ++t) {
+        decodeThreads.push_back(std::thread([&]() {
+            try {
+                for (size_t i = nextDecode++; i < jobs.size(); i = nextDecode++) {
+                    auto start = Clock::now();
+                    DecodedJob job;
+                    job.index = i;
+                    job.image = openImage(jobs[i].input);
+                    job.decodeTime = millisecondsSince(start);
+                    addDecodeTime(job.image, job.decodeTime, true);
+                    if (verbose) {
+                        std::lock_guard<std::mutex> lock(decodeMutex);
+                        cout << "opened " << jobs[i].input << ", " << job.image.width << "x" << job.image.height << endl;
+                    }
+                    if (resultCache != NULL && findCachedResult(job)) {
+                        continue;
+                    }
+                    decoded.push(std::move(job));
+                }
+            }
+            catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(decodeMutex);
+                if (decodeError.empty()) {
+                    decodeError = e.what();
+                }
+            }
+            if (--runningDecoders == 0) {
+                decoded.close();
+            }
+        }));
+    }
+
+    std::thread encodeThread([&]() {
+        EncodeJob job;
+        while (encoded.pop(job)) {
+            //keep draining after a failure, otherwise the submit thread would block forever
+            if (!encodeError.empty()) {
+                continue;
+            }
+            try {
+                auto start = Clock::now();
+                if (job.cachedFile) {
+                    writeFile(job.output, *job.cachedFile);
+                }
+                else if (!job.cacheKey.empty()) {
+                    std::shared_ptr<std::vector<unsigned char>> file = std::make_shared<std::vector<unsigned char>>(encodeImage(job.image, job.output, pngCompressionLevel));
+                    writeFile(job.output, *file);
+                    resultCache->store(job.cacheKey, file);
+                }
+                else {
+                    saveImage(job.image, job.output, pngCompressionLevel);
+                }
+                double encodeTime = millisecondsSince(start);
+                stats.encodeTime += encodeTime / 1000.0;
+
+                if (timingReport != NULL) {
+                    job.timings.add("encode", encodeTime);
+                    timingReport->add(job.timings);
+                }
+            }
+            catch (const std::exception& e) {
+                encodeError = e.what();
+            }
+        }
+    });
+
+    //After a failure on the submit or the CPU thread, the decode threads take no new jobs, and what
+    //they already decoded is thrown away, so none of them stays blocked on a full queue.
+    auto stopDecoding = [&]() {
+        nextDecode = jobs.size();
+        DecodedJob skipped;
+        while (decoded.pop(skipped)) {
+        }
+    };
+
+    //the CPU engine has no filter graphs and no box blur, those images all go to the GPU
+    std::string cpuError;
+    std::thread cpuThread;
+    if (cpuCoprocessor != NULL && !params.graph && !usesBoxBlur(params)) {
+        cpuThread = std::thread([&]() {
+            DecodedJob input;
+            try {
+                while (decoded.pop(input)) {
+                    decodeRemainingRows(input);
+                    auto start = Clock::now();
+                    EncodeJob encodeJob;
+                    encodeJob.image = cpuCoprocessor->process(input.image, params);
+                    encodeJob.output = jobs[input.index].output;
+                    encodeJob.cacheKey = input.cacheKey;
+                    encodeJob.timings.image = jobs[input.index].input;
+                    encodeJob.timings.kernel = "cpu";
+                    encodeJob.timings.width = input.image.width;
+                    encodeJob.timings.height = input.image.height;
+                    encodeJob.timings.add("decode", input.decodeTime);
+                    encodeJob.timings.add("cpu_process", millisecondsSince(start));
+                    stats.cpuTime += Seconds(Clock::now() - start).count();
+                    ++stats.cpuImages;
+                    encoded.push(std::move(encodeJob));
+                }
+            }
+            catch (const std::exception& e) {
+                cpuError = e.what();
+                stopDecoding();
+            }
+        });
+    }
+
+    //keys of the jobs in flight on the GPU, by job index
+    std::vector<std::string> cacheKeys(resultCache != NULL ? jobs.size() : 0);
+
+    //waits for a frame, reads its result back and hands it to the encode thread
+    auto retireFrame = [&](Frame& frame, const BatchJob& job) {
+        auto waitStart = Clock::now();
+        waitForFrame(frame);
+        auto readbackStart = Clock::now();
+        EncodeJob encodeJob;
+        readFromOutputBuffer(frame, encodeJob.image);
+        stats.gpuWaitTime += Seconds(readbackStart - waitStart).count();
+        stats.readbackTime += Seconds(Clock::now() - readbackStart).count();
+
+        frame.timings.add("read_output", millisecondsSince(readbackStart));
+        frame.timings.image = job.input;
+        encodeJob.output = job.output;
+        encodeJob.timings = frame.timings;
+        if (!cacheKeys.empty()) {
+            encodeJob.cacheKey = std::move(cacheKeys[frame.jobIndex]);
+        }
+        encoded.push(std::move(encodeJob));
+    };
+
+    //the first error of this thread, thrown once every thread finished
+    std::string submitError;
+    size_t submitted = 0;
+    try {
+        DecodedJob input;
+        while (true) {
+
+            auto decodeWaitStart = Clock::now();
+            if (!decoded.pop(input)) {
+                break;
+            }
+            stats.decodeWaitTime += Seconds(Clock::now() - decodeWaitStart).count();
+
+            //an image too large for one set of buffers takes all frames for its tiles
+            if (needsTiling(input.image)) {
+                for (size_t i = 0; i < frames.size(); ++i) {
+                    Frame& frame = frames[(submitted + i) % frames.size()];
+                    if (frame.inFlight) {
+                        retireFrame(frame, jobs[frame.jobIndex]);
+                    }
+                }
+
+                decodeRemainingRows(input);
+                auto tiledStart = Clock::now();
+                EncodeJob encodeJob;
+                encodeJob.image = processTiled(input.image, params);
+                encodeJob.output = jobs[input.index].output;
+                encodeJob.cacheKey = input.cacheKey;
+                encodeJob.timings = frames[0].timings;
+                encodeJob.timings.image = jobs[input.index].input;
+                encodeJob.timings.stages.insert(encodeJob.timings.stages.begin(), std::make_pair(std::string("decode"), input.decodeTime));
+                stats.uploadTime += Seconds(Clock::now() - tiledStart).count();
+                encoded.push(std::move(encodeJob));
+                ++submitted;
+                continue;
+            }
 
-	string imageName = "resources/images/beach.png";
+            //reuse the frame of the job that ran framesInFlight jobs ago
+            Frame& frame = frames[submitted % frames.size()];
+            if (frame.inFlight) {
+                retireFrame(frame, jobs[frame.jobIndex]);
+            }
+
+            auto uploadStart = Clock::now();
+
+            prepareFrame(frame, input.image, params);
+            if (frame.rowDecodeTime > 0.0) {
+                addDecodeTime(input.image, frame.rowDecodeTime, false);
+            }
+            frame.timings.stages.insert(frame.timings.stages.begin(), std::make_pair(std::string("decode"), input.decodeTime));
+            frame.jobIndex = input.index;
+            if (!cacheKeys.empty()) {
+                cacheKeys[input.index] = input.cacheKey;
+            }
+            submitFrame(frame);
+            stats.uploadTime += Seconds(Clock::now() - uploadStart).count();
+            if (frame.reusedCommands) {
+                ++stats.reusedCommandBuffers;
+            }
+            ++submitted;
+        }
+
+        //the last frames are still in flight, retire them oldest first
+        for (size_t i = 0; i < frames.size(); ++i) {
+            Frame& frame = frames[(submitted + i) % frames.size()];
+            if (frame.inFlight) {
+                retireFrame(frame, jobs[frame.jobIndex]);
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        submitError = e.what();
+
+        //frames submitted before the failure are still running, their buffers must stay until they finished.
+        //A frame that failed before its submit may still hold imported input.
+        for (size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i].inFlight) {
+                waitForFrame(frames[i]);
+            }
+            releaseImportedInput(frames[i]);
+        }
+        stopDecoding();
+    }
+
+    if (cpuThread.joinable()) {
+        cpuThread.join();
+    }
+    encoded.close();
+    for (size_t t = 0; t < decodeThreads.size(); ++t) {
+        decodeThreads[t].join();
+    }
+    encodeThread.join();
+
+    stats.images = (uint32_t)submitted + stats.cpuImages + stats.cachedImages;
+    stats.totalTime = Seconds(Clock::now() - batchStart).count();
+
+    if (!submitError.empty()) {
+        throw std::runtime_error(submitError);
+    }
+    if (!cpuError.empty()) {
+        throw std::runtime_error(cpuError);
+    }
+    if (!decodeError.empty()) {
+        throw std::runtime_error(decodeError);
+    }
+    if (!encodeError.empty()) {
+        throw std::runtime_error(encodeError);
+    }
+    return stats;
+}
+
+void ComputeApplication::prepareFrame(Frame& frame, const Image& input, const FilterParams& params) {
+
+    frame.imageWidth = input.width;
+    frame.imageHeight = input.height;
+    frame.outputWidth = input.width;
+    frame.outputHeight = input.height;
+    frame.imageSize = (VkDeviceSize)bytesPerPixel(pixelFormat) * frame.imageWidth * frame.imageHeight;
+    frame.intermediateSize = (VkDeviceSize)sizeof(Color) * frame.imageWidth * frame.imageHeight;
+    frame.activeBlurMode = resolveBlurMode(params);
+
+    //a graph that resizes writes an output of another size, and its passes may write larger images
+    //to the float buffers than the input
+    if (frame.activeBlurMode == BLUR_MODE_GRAPH) {
+        if (!params.graph) {
+            throw std::runtime_error("the graph blur mode needs a filter graph");
+        }
+        frame.graphPasses = params.graph->compile(input.width, input.height);
+        frame.outputWidth = frame.graphPasses.back().width;
+        frame.outputHeight = frame.graphPasses.back().height;
+        VkDeviceSize outputPixels = (VkDeviceSize)frame.outputWidth * frame.outputHeight;
+        frame.imageSize = max(frame.imageSize, bytesPerPixel(pixelFormat) * outputPixels);
+        for (size_t i = 0; i + 1 < frame.graphPasses.size(); ++i) {
+            VkDeviceSize passPixels = (VkDeviceSize)frame.graphPasses[i].width * frame.graphPasses[i].height;
+            frame.intermediateSize = max(frame.intermediateSize, sizeof(Color) * passPixels);
+        }
+        if (frame.imageSize > maxTileBytes() || frame.intermediateSize > maxTileBytes()) {
+            throw std::runtime_error("the filter graph resizes to more than fits the buffer limits");
+        }
+    }
+
+    frame.timings = ImageTimings();
+    frame.timings.width = input.width;
+    frame.timings.height = input.height;
+
+    //grow the GPU buffers if this image is larger than all previous ones of this frame
+    reserveImageBuffers(frame);
+
+    //write this job's data, or let the GPU copy it from where it was loaded
+    auto writeStart = std::chrono::high_resolution_clock::now();
+    frame.rowDecodeTime = 0.0;
+    if (importInput(frame, input)) {
+        frame.timings.add("import_input", millisecondsSince(writeStart));
+    }
+    else {
+        writeToInputBuffer(frame, input);
+        double writeTime = millisecondsSince(writeStart);
+        if (input.decoded()) {
+            frame.timings.add("write_input", writeTime);
+        }
+        else {
+            frame.rowDecodeTime = writeTime;
+            frame.timings.add("decode_rows", writeTime);
+        }
+    }
+
+    //record the kernels for this image size and blur mode.
+    //The graph passes ping-pong between the intermediate and the box buffer, the kernel binds both.
+    if (frame.activeBlurMode == BLUR_MODE_GRAPH) {
+        writeToGraphBuffer(frame, params);
+    }
+    else {
+        writeToWeightBuffer(frame, params.blur);
+    }
+    if (frame.activeBlurMode == BLUR_MODE_BOX || frame.activeBlurMode == BLUR_MODE_GRAPH) {
+        reserveBoxBuffer(frame);
+    }
+
+    //the box blur and graph kernels do not depend on the blur size
+    frame.specializedBlurSize = 0;
+    if (specializeBlurSize && frame.activeBlurMode != BLUR_MODE_BOX && frame.activeBlurMode != BLUR_MODE_GRAPH &&
+        blurWindowSize(params.blur) <= MAX_SPECIALIZED_BLUR_SIZE) {
+        frame.specializedBlurSize = blurWindowSize(params.blur);
+    }
+    frame.timings.kernel = blurModeName(frame.activeBlurMode);
+
+    //the commands only depend on the image size and the settings, the pixels are in the buffers
+    auto recordStart = std::chrono::high_resolution_clock::now();
+    frame.reusedCommands = canReuseCommands(frame, params);
+    if (!frame.reusedCommands) {
+        recordCommandBuffer(frame, params);
+    }
+    frame.timings.add("record", millisecondsSince(recordStart));
+}
+
+bool ComputeApplication::canReuseCommands(const Frame& frame, const FilterParams& params) const {
+
+    //imported input is a new buffer for every job
+    const RecordedCommands& recorded = frame.recorded;
+    if (!reuseCommandBuffers || !recorded.valid || frame.importedInputBuffer != VK_NULL_HANDLE) {
+        return false;
+    }
+    return recorded.width == frame.imageWidth && recorded.height == frame.imageHeight &&
+        recorded.blurMode == frame.activeBlurMode && recorded.specializedBlurSize == frame.specializedBlurSize &&
+        recorded.workgroupWidth == workgroupWidth && recorded.workgroupHeight == workgroupHeight &&
+        memcmp(recorded.params.color, params.color, sizeof(params.color)) == 0 &&
+        recorded.params.saturation == params.saturation && recorded.params.blur == params.blur &&
+        recorded.params.graph == params.graph;
+}
+
+void ComputeApplication::setPixelFormat(PixelFormat format) {
+    pixelFormat = format;
+}
+
+void ComputeApplication::setFramesInFlight(uint32_t count) {
+    framesInFlight = max(count, 1u);
+}
+
+void ComputeApplication::setCpuCoprocessor(CpuEngine* engine) {
+    cpuCoprocessor = engine;
+}
+
+void ComputeApplication::setTileMemoryBudget(VkDeviceSize bytes) {
+    tileMemoryBudget = bytes;
+}
+
+void ComputeApplication::setPngCompressionLevel(int level) {
+    pngCompressionLevel = min(max(level, PNG_STORE), PNG_BEST_COMPRESSION);
+}
+
+void ComputeApplication::setVerbose(bool enabled) {
+    verbose = enabled;
+}
+
+const ImageTimings& ComputeApplication::lastTimings() const {
+    return frames[0].timings;
+}
+
+const char* ComputeApplication::blurModeName(BlurMode mode) {
+    const char* modeNames[] = { "reference", "separable", "tiled", "box", "graph" };
+    return modeNames[mode];
+}
+
+void ComputeApplication::setTimingReport(TimingReport* report) {
+    timingReport = report;
+}
+
+void ComputeApplication::setSpecializeBlurSize(bool enabled) {
+    specializeBlurSize = enabled;
+}
+
+void ComputeApplication::setBoxBlurRadius(int32_t radius) {
+    boxBlurRadius = max(radius, 0);
+}
+
+void ComputeApplication::setReuseCommandBuffers(bool enabled) {
+    reuseCommandBuffers = enabled;
+}
+
+void ComputeApplication::setResultCache(ResultCache* cache) {
+    resultCache = cache;
+}
+
+void ComputeApplication::setPipelineCacheFile(const std::string& filename) {
+    pipelineCacheFile = filename;
+}
+
+void ComputeApplication::printMemoryStats() const {
+    cout << (useStagingBuffers ? "images are copied through staging buffers" : "images are mapped directly") << endl;
+    allocator.getStats().print();
+}
+
+void ComputeApplication::printPipelineCacheStats() const {
+
+    cout << "pipeline creation took " << pipelineCreationTime << " ms";
+    if (pipelineCacheLoaded) {
+        cout << " with a warm cache, " << coldPipelineCreationTime << " ms cold, saved "
+            << coldPipelineCreationTime - pipelineCreationTime << " ms";
+    }
+    else {
+        cout << " with a cold cache";
+    }
+    cout << endl;
+}
+
+void BatchStats::print() const {
+
+    //share of the wall clock time each stage was busy. The stage close to 100% limits the
+    //throughput, when none is, more frames in flight can help.
+    cout << images << " images in " << totalTime << " s, " << images / totalTime << " images/sec" << endl;
+    cout << "decode:    " << 100.0 * decodeTime / totalTime << "%" << endl;
+    cout << "upload:    " << 100.0 * uploadTime / totalTime << "%" << endl;
+    cout << "gpu wait:  " << 100.0 * gpuWaitTime / totalTime << "%" << endl;
+    cout << "readback:  " << 100.0 * readbackTime / totalTime << "%" << endl;
+    cout << "encode:    " << 100.0 * encodeTime / totalTime << "%" << endl;
+    if (cpuImages != 0) {
+        cout << "cpu:       " << 100.0 * cpuTime / totalTime << "%, " << cpuImages << " images" << endl;
+    }
+    if (cachedImages != 0) {
+        cout << "cached:    " << cachedImages << " images written from the result cache" << endl;
+    }
+    cout << "idle on decode: " << 100.0 * decodeWaitTime / totalTime << "%" << endl;
+    cout << "command buffers reused: " << reusedCommandBuffers << " of " << images - cpuImages - cachedImages << endl;
+
+    //decode time is summed over the decode threads, so this is the speed of one thread
+    for (std::map<std::string, FormatStats>::const_iterator it = decodeFormats.begin(); it != decodeFormats.end(); ++it) {
+        if (it->second.seconds > 0.0) {
+            cout << "decode " << it->first << ": " << it->second.images << " images, "
+                << it->second.megapixels / it->second.seconds << " MP/s" << endl;
+        }
+    }
+}
+
+uint32_t ComputeApplication::bytesPerPixel(PixelFormat format) {
+    switch (format) {
+    case PIXEL_FORMAT_RGBA8:
+        return 4;
+    case PIXEL_FORMAT_RGBA16F:
+        return 4 * sizeof(uint16_t);
+    default:
+        return sizeof(Color);
+    }
+}
+
+std::vector<float> ComputeApplication::computeGaussWeights(int32_t blur) {
+
+    int32_t n = blurWindowSize(blur);
+    int32_t radius = n / 2;
+
+    //same sigma as gaussKernel() in common.glsl. The constant factor in front of the
+    //exponential cancels out once the weights are normalized, so it is left out.
+    double sigma = floor(n / 2.0) / 2.0;
+
+    std::vector<double> weights(n);
+    double sum = 0.0;
+    for (int32_t i = 0; i < n; ++i) {
+        double x = i - radius;
+        weights[i] = exp(-(x * x) / (2.0 * sigma * sigma));
+        sum += weights[i];
+    }
+
+    std::vector<float> normalized(n);
+    for (int32_t i = 0; i < n; ++i) {
+        normalized[i] = (float)(weights[i] / sum);
+    }
+    return normalized;
+}
+
+void ComputeApplication::computeBoxRadii(int32_t blur, int32_t radii[3]) {
+
+    //Three boxes of width w have the variance 3 * (w * w - 1) / 12. The ideal width is rarely odd,
+    //so the two odd widths around it are mixed in the ratio that comes closest to the gaussian's
+    //variance, as in Kovesi's "Fast Almost-Gaussian Filtering".
+    int32_t n = blurWindowSize(blur);
+    double variance = floor(n / 2.0) / 2.0 * (floor(n / 2.0) / 2.0);
+    int32_t lower = (int32_t)floor(sqrt(12.0 * variance / 3.0 + 1.0));
+    if (lower % 2 == 0) {
+        lower -= 1;
+    }
+    int32_t upper = lower + 2;
+    int32_t lowerCount = (int32_t)floor((12.0 * variance - 3.0 * lower * lower - 12.0 * lower - 9.0) / (-4.0 * lower - 4.0) + 0.5);
+    lowerCount = min(max(lowerCount, 0), 3);
+
+    for (int32_t i = 0; i < 3; ++i) {
+        radii[i] = ((i < lowerCount ? lower : upper) - 1) / 2;
+    }
+}
+
+double ComputeApplication::boxBlurErrorBound(int32_t blur) {
+
+    std::vector<float> gauss = computeGaussWeights(blur);
+    int32_t gaussRadius = (int32_t)gauss.size() / 2;
+    int32_t radii[3];
+    computeBoxRadii(blur, radii);
+
+    //the stacked boxes as one kernel, the three boxes applied to a single 1
+    int32_t extent = max(gaussRadius, radii[0] + radii[1] + radii[2]);
+    std::vector<double> kernel(2 * extent + 1, 0.0);
+    kernel[extent] = 1.0;
+    for (int32_t pass = 0; pass < 3; ++pass) {
+        std::vector<double> sums(kernel.size() + 1, 0.0);
+        for (size_t i = 0; i < kernel.size(); ++i) {
+            sums[i + 1] = sums[i] + kernel[i];
+        }
+        int32_t r = radii[pass];
+        for (int32_t x = 0; x < (int32_t)kernel.size(); ++x) {
+            int32_t first = max(x - r, 0);
+            int32_t last = min(x + r + 1, (int32_t)kernel.size());
+            kernel[x] = (sums[last] - sums[first]) / (2 * r + 1);
+        }
+    }
+
+    double distance = 0.0;
+    for (int32_t x = -extent; x <= extent; ++x) {
+        double weight = abs(x) <= gaussRadius ? gauss[x + gaussRadius] : 0.0;
+        distance += fabs(kernel[x + extent] - weight);
+    }
+    return 255.0 * distance;
+}
+
+// Raw RGBA8 files carry their size in the name, like frame.1920x1080.rgba.
+static bool parseRawImageName(const std::string& imageName, uint32_t& width, uint32_t& height) {
+
+    const std::string extension = ".rgba";
+    if (imageName.size() <= extension.size() || imageName.compare(imageName.size() - extension.size(), extension.size(), extension) != 0) {
+        return false;
+    }
+    std::string stem = imageName.substr(0, imageName.size() - extension.size());
+    size_t dot = stem.find_last_of('.');
+    unsigned int parsedWidth = 0;
+    unsigned int parsedHeight = 0;
+    if (dot == std::string::npos || sscanf(stem.c_str() + dot + 1, "%ux%u", &parsedWidth, &parsedHeight) != 2 ||
+        parsedWidth == 0 || parsedHeight == 0) {
+        throw std::runtime_error("Compute Application::loadImage: raw image " + imageName + " needs its size in the name, like image.640x480.rgba");
+    }
+    width = parsedWidth;
+    height = parsedHeight;
+    return true;
+}
+
+#ifndef _WIN32
+// Maps everything behind an open file descriptor and closes it. Returns null if it fails.
+static std::shared_ptr<const unsigned char> mapDescriptor(int file, size_t& size) {
+
+    struct stat fileStat;
+    if (file < 0 || fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+        if (file >= 0) {
+            close(file);
+        }
+        return std::shared_ptr<const unsigned char>();
+    }
+    size = (size_t)fileStat.st_size;
+
+    //Private and writable, so drivers that pin imported pages for writing accept it. Nothing writes
+    //to it, so the pages stay shared with the page cache.
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        return std::shared_ptr<const unsigned char>();
+    }
+    size_t mappedSize = size;
+    return std::shared_ptr<const unsigned char>((const unsigned char*)mapping,
+        [mappedSize](const unsigned char* pointer) { munmap((void*)pointer, mappedSize); });
+}
+#endif
+
+// Memory maps a whole file, nothing is read until the bytes are used. Returns null if it fails.
+static std::shared_ptr<const unsigned char> mapFile(const std::string& fileName, size_t& size) {
+
+#ifdef _WIN32
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return std::shared_ptr<const unsigned char>();
+    }
+    size = (size_t)file.tellg();
+    unsigned char* contents = new unsigned char[size];
+    file.seekg(0);
+    if (!file.read((char*)contents, size)) {
+        delete[] contents;
+        return std::shared_ptr<const unsigned char>();
+    }
+    return std::shared_ptr<const unsigned char>(contents, [](const unsigned char* pointer) { delete[] pointer; });
+#else
+    return mapDescriptor(open(fileName.c_str(), O_RDONLY), size);
+#endif
+}
+
+// Maps a POSIX shared memory object another process wrote, like mapFile(). Returns null if it fails.
+static std::shared_ptr<const unsigned char> mapSharedMemory(const std::string& name, size_t& size) {
+
+#ifdef _WIN32
+    return std::shared_ptr<const unsigned char>();
+#else
+    return mapDescriptor(shm_open(name.c_str(), O_RDONLY, 0), size);
+#endif
+}
+
+// Raw RGBA8 files are used where they are mapped. Names starting with shm: are shared memory
+// objects, like shm:/frame.1920x1080.rgba, so another process can hand over pixels without a file.
+static Image loadRawImage(const std::string& imageName, uint32_t width, uint32_t height) {
+
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.format = "rgba";
+
+    size_t fileSize = 0;
+    if (imageName.compare(0, 4, "shm:") == 0) {
+        image.external = mapSharedMemory(imageName.substr(4), fileSize);
+    }
+    else {
+        image.external = mapFile(imageName, fileSize);
+    }
+    if (!image.external || fileSize != (size_t)width * height * 4) {
+        throw std::runtime_error("Compute Application::loadImage: " + imageName + " is not a raw image of " +
+            std::to_string(width) + "x" + std::to_string(height) + " RGBA8 pixels");
+    }
+    return image;
+}
+
+static uint32_t readLittleEndian(const unsigned char* p, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/*
+Opens an uncompressed 24 bit BMP without decoding it. The file is mapped, and decodeRows turns
+rows of BGR pixels, stored bottom up, into RGBA8 rows. Returns false for every other kind of BMP,
+those are left to stb_image.
+*/
+static bool openBmpImage(const std::string& imageName, Image& image) {
+
+    size_t fileSize = 0;
+    std::shared_ptr<const unsigned char> file = mapFile(imageName, fileSize);
+    if (!file || fileSize < 54 || file.get()[0] != 'B' || file.get()[1] != 'M') {
+        return false;
+    }
+    const unsigned char* header = file.get();
+    uint32_t dataOffset = readLittleEndian(header + 10, 4);
+    uint32_t infoSize = readLittleEndian(header + 14, 4);
+    int32_t width = (int32_t)readLittleEndian(header + 18, 4);
+    int32_t height = (int32_t)readLittleEndian(header + 22, 4);
+    uint32_t bitsPerPixel = readLittleEndian(header + 28, 2);
+    uint32_t compression = readLittleEndian(header + 30, 4);
+
+    //rows are padded to 4 bytes, a negative height means the rows are stored top down
+    bool topDown = height < 0;
+    uint32_t rows = (uint32_t)(topDown ? -(int64_t)height : height);
+    size_t stride = ((size_t)width * 3 + 3) / 4 * 4;
+    if (infoSize < 40 || width <= 0 || rows == 0 || bitsPerPixel != 24 || compression != 0 ||
+        dataOffset > fileSize || (fileSize - dataOffset) / stride < rows) {
+        return false;
+    }
+
+    image.width = (uint32_t)width;
+    image.height = rows;
+    image.format = "bmp";
+    image.decodeRows = [file, dataOffset, stride, rows, topDown, width](uint32_t firstRow, uint32_t rowCount, unsigned char* out) {
+        for (uint32_t y = firstRow; y < firstRow + rowCount; ++y) {
+            const unsigned char* source = file.get() + dataOffset + (topDown ? y : rows - 1 - y) * stride;
+            for (int32_t x = 0; x < width; ++x) {
+                out[x * 4 + 0] = source[x * 3 + 2];
+                out[x * 4 + 1] = source[x * 3 + 1];
+                out[x * 4 + 2] = source[x * 3 + 0];
+                out[x * 4 + 3] = 255;
+            }
+            out += (size_t)width * 4;
+        }
+    };
+    return true;
+}
+
+// Lower case extension without the dot.
+static std::string fileExtension(const std::string& fileName) {
+
+    size_t dot = fileName.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : fileName.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+Image ComputeApplication::openImage(const std::string& imageName){
+
+    uint32_t rawWidth;
+    uint32_t rawHeight;
+    if (parseRawImageName(imageName, rawWidth, rawHeight)) {
+        return loadRawImage(imageName, rawWidth, rawHeight);
+    }
+
+    Image image;
+    std::string format = fileExtension(imageName);
+    if (format == "bmp" && openBmpImage(imageName, image)) {
+        return image;
+    }
+
+    //read in the file here, in the channels it has
+    int numChannels = -1;
+    int imageWidth, imageHeight;
+
+    //load image
+    unsigned char* imageData = stbi_load(imageName.c_str(), &imageWidth, &imageHeight, &numChannels, 0);
+    if (imageData == NULL || numChannels == -1) {
+        std::string error =  "Compute Application::loadImage: failed to load image " + imageName + "\n";
+        throw std::runtime_error(error.c_str());
+    }
+
+    //keep the decoded pixels where they are, they are freed with the last copy of the image
+    image.width = imageWidth;
+    image.height = imageHeight;
+    image.format = format;
+    std::shared_ptr<const unsigned char> decoded(imageData, [](const unsigned char* pointer) { stbi_image_free((void*)pointer); });
+    if (numChannels == 4) {
+        image.external = decoded;
+        return image;
+    }
+
+    //gray, gray alpha and RGB images get their missing channels while their rows are written
+    int channels = numChannels;
+    uint32_t width = image.width;
+    image.decodeRows = [decoded, channels, width](uint32_t firstRow, uint32_t rowCount, unsigned char* out) {
+        const unsigned char* source = decoded.get() + (size_t)firstRow * width * channels;
+        for (size_t i = 0; i < (size_t)rowCount * width; ++i, source += channels, out += 4) {
+            if (channels >= 3) {
+                out[0] = source[0];
+                out[1] = source[1];
+                out[2] = source[2];
+            }
+            else {
+                out[0] = out[1] = out[2] = source[0];
+            }
+            out[3] = channels == 2 ? source[1] : 255;
+        }
+    };
+    return image;
+}
+
+void ComputeApplication::decodeImage(Image& image) {
+
+    if (image.decoded() || !image.decodeRows) {
+        return;
+    }
+    image.pixels.resize((size_t)image.width * image.height * 4);
+    image.decodeRows(0, image.height, image.pixels.data());
+
+    //releases the file or the decoder's buffer
+    image.decodeRows = nullptr;
+}
+
+Image ComputeApplication::loadImage(const std::string& imageName){
+
+    Image image = openImage(imageName);
+    decodeImage(image);
+    return image;
+}
+
+void ComputeApplication::saveImage(const Image& image, const std::string& filename, int compressionLevel) {
+
+    //raw RGBA8 output, the size has to be part of the name to load it again
+    uint32_t rawWidth;
+    uint32_t rawHeight;
+    if (parseRawImageName(filename, rawWidth, rawHeight)) {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (rawWidth != image.width || rawHeight != image.height ||
+            !file.write((const char*)image.data(), (size_t)image.width * image.height * 4)) {
+            throw std::runtime_error("Compute Application::saveImage: failed to write " + filename);
+        }
+        return;
+    }
+    writeFile(filename, encodeImage(image, filename, compressionLevel));
+}
 
-    //read in the file here
-    int numChannels = -1;
-    int imageWidth, imageHeight;
+std::vector<unsigned char> ComputeApplication::encodeImage(const Image& image, const std::string& filename, int compressionLevel) {
 
-    //load image
-    inputImageData = stbi_load(imageName.c_str(), &imageWidth, &imageHeight, &numChannels, STBI_rgb_alpha);
-    if (numChannels == -1) {
-        std::string error =  "Compute Application::loadImage: failed to load image " + imageName + "\n";
-        throw std::runtime_error(error.c_str());
+    uint32_t rawWidth;
+    uint32_t rawHeight;
+    if (parseRawImageName(filename, rawWidth, rawHeight)) {
+        if (rawWidth != image.width || rawHeight != image.height) {
+            throw std::runtime_error("Compute Application::saveImage: " + filename + " does not match the image size");
+        }
+        return std::vector<unsigned char>(image.data(), image.data() + (size_t)image.width * image.height * 4);
     }
-    cout << "loaded " << imageName << endl;
-    cout << "Num numChannels: " << numChannels << endl;
-    cout << "Width: " << imageWidth << endl << "Height: " << imageHeight << endl;
 
-    OUTPUT_WIDTH = imageWidth;
-    OUTPUT_HEIGHT = imageHeight;
-
-    imageSize = sizeof(Color) * OUTPUT_WIDTH * OUTPUT_HEIGHT;
+    // Now we save the acquired color data to a .png, its row bands are compressed on all cores.
+    static PngWriter pngWriter;
+    return pngWriter.encode(image.data(), image.width, image.height, compressionLevel);
+}
 
+std::string ComputeApplication::resultSettings(const FilterParams& params, const std::string& outputName) const {
+
+    //everything besides the input pixels that changes the output file
+    std::ostringstream settings;
+    settings << std::setprecision(9) << "format=" << pixelFormat << " output=" << fileExtension(outputName)
+        << " level=" << pngCompressionLevel;
+    if (params.graph) {
+        const std::vector<FilterOp>& ops = params.graph->operations();
+        for (size_t i = 0; i < ops.size(); ++i) {
+            const FilterOp& op = ops[i];
+            settings << " op=" << op.type << ":" << op.values[0] << ":" << op.values[1] << ":" << op.values[2] << ":" << op.values[3]
+                << ":" << op.size << ":" << op.width << "x" << op.height;
+            if (!op.lut.empty()) {
+                settings << ":lut" << ResultCache::hash(op.lut.data(), op.lut.size() * sizeof(float));
+            }
+        }
+        return settings.str();
+    }
+    settings << " color=" << params.color[0] << ":" << params.color[1] << ":" << params.color[2] << ":" << params.color[3]
+        << " saturation=" << params.saturation << " blur=" << params.blur << " mode=" << blurModeName(params.blurMode)
+        << " box=" << usesBoxBlur(params);
+    return settings.str();
 }
 
-void ComputeApplication::saveRenderedImage() {
-    void* mappedMemory = NULL;
-    
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, outputBufferMemory, 0, imageSize, 0, &mappedMemory);
-    Color* pmappedMemory = (Color *)mappedMemory;
+void ComputeApplication::readFromOutputBuffer(Frame& frame, Image& output) {
+    // The buffer memory stays mapped, so that we can read from it on the CPU.
+    void* mappedMemory = frame.outputHostPointer;
+
+    output.width = frame.outputWidth;
+    output.height = frame.outputHeight;
 
     // Get the color data from the buffer, and cast it to bytes.
-    // We save the data to a vector.
-    std::vector<unsigned char> image;
-    image.reserve(OUTPUT_WIDTH * OUTPUT_HEIGHT * 4);
-    for (uint32_t i = 0; i < OUTPUT_WIDTH * OUTPUT_HEIGHT; i += 1) {
+    size_t pixelCount = (size_t)frame.outputWidth * frame.outputHeight;
+    output.pixels.resize(pixelCount * 4);
 
-        image.push_back((unsigned char)pmappedMemory[i].r);
-        image.push_back((unsigned char)pmappedMemory[i].g);
-        image.push_back((unsigned char)pmappedMemory[i].b);
-        image.push_back((unsigned char)pmappedMemory[i].a);
+    if (pixelFormat == PIXEL_FORMAT_RGBA8) {
+        // RGBA8 output already is the png pixel layout
+        memcpy(output.pixels.data(), mappedMemory, pixelCount * 4);
+    }
+    else if (pixelFormat == PIXEL_FORMAT_RGBA16F) {
+        uint16_t* pmappedMemory = (uint16_t*)mappedMemory;
+        for (size_t i = 0; i < pixelCount * 4; i += 1) {
+            output.pixels[i] = (unsigned char)halfToFloat(pmappedMemory[i]);
+        }
+    }
+    else {
+        floatsToBytes((const float*)mappedMemory, output.pixels.data(), pixelCount * 4);
     }
-    // Done reading, so unmap.
-    vkUnmapMemory(device, outputBufferMemory);
-
-    // Now we save the acquired color data to a .png.
-    stbi_write_png("Simple Image.png", OUTPUT_WIDTH, OUTPUT_HEIGHT, 4, image.data(), OUTPUT_WIDTH * 4);
 }
 
 
@@ -141,10 +1598,13 @@ void ComputeApplication::createInstance() {
 
     /*
     By enabling validation layers, Vulkan will emit warnings if the API
-    is used incorrectly. We shall enable the layer VK_LAYER_LUNARG_standard_validation,
-    which is basically a collection of several useful validation layers.
+    is used incorrectly. We shall enable the layer VK_LAYER_KHRONOS_validation, or
+    VK_LAYER_LUNARG_standard_validation on older SDKs, which is basically a collection of several useful validation layers.
+    Machines without the SDK (e.g. CI with a software driver) just run without them.
     */
-    if (enableValidationLayers) {
+    useValidationLayers = enableValidationLayers;
+    const char* foundLayer = NULL;
+    if (useValidationLayers) {
         /*
         We get all supported layers with vkEnumerateInstanceLayerProperties.
         */
@@ -155,22 +1615,28 @@ void ComputeApplication::createInstance() {
         vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
 
         /*
-        And then we simply check if VK_LAYER_LUNARG_standard_validation is among the supported layers.
+        And then we simply check if one of the validation layers is among the supported layers.
         */
-        bool foundLayer = false;
         for (VkLayerProperties prop : layerProperties) {
             
-            if (strcmp("VK_LAYER_LUNARG_standard_validation", prop.layerName) == 0) {
-                foundLayer = true;
+            if (strcmp("VK_LAYER_KHRONOS_validation", prop.layerName) == 0) {
+                foundLayer = "VK_LAYER_KHRONOS_validation";
                 break;
             }
+            if (strcmp("VK_LAYER_LUNARG_standard_validation", prop.layerName) == 0) {
+                foundLayer = "VK_LAYER_LUNARG_standard_validation";
+            }
 
         }
         
-        if (!foundLayer) {
-            throw std::runtime_error("Layer VK_LAYER_LUNARG_standard_validation not supported\n");
+        if (foundLayer == NULL) {
+            cout << "validation layers not available, running without them" << endl;
+            useValidationLayers = false;
         }
-        enabledLayers.push_back("VK_LAYER_LUNARG_standard_validation"); // Alright, we can use this layer.
+    }
+
+    if (useValidationLayers) {
+        enabledLayers.push_back(foundLayer); // Alright, we can use this layer.
 
         /*
         We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
@@ -198,7 +1664,7 @@ void ComputeApplication::createInstance() {
             throw std::runtime_error("Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
         }
         enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-    }//End if(enableValidationLayers)
+    }//End if(useValidationLayers)
 
 
     /*
@@ -233,13 +1699,17 @@ void ComputeApplication::createInstance() {
     Actually create the instance.
     Having created the instance, we can actually start using vulkan.
     */
-    VK_CHECK_RESULT( vkCreateInstance( &createInfo, NULL, &instance));
+    //no driver is not a programming error, so callers can fall back to the CPU engine
+    VkResult result = vkCreateInstance(&createInfo, NULL, &instance);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("could not create a vulkan instance, VkResult " + std::to_string(result));
+    }
 
     /*
     Register a callback function for the extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the validation
     layer are actually printed.
     */
-    if (enableValidationLayers) {
+    if (useValidationLayers) {
         VkDebugReportCallbackCreateInfoEXT createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
         createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
@@ -285,8 +1755,9 @@ void ComputeApplication::findPhysicalDevice() {
     maxComputeWorkGroupSize are not exceeded by our application.  Moreover, we are using a storage buffer in the compute shader,
     and we should ensure that it is not larger than the device can handle, by checking the limitation maxStorageBufferRange. 
 
-    However, in our application, the workgroup size and total number of shader invocations is relatively small, and the storage buffer is
-    not that large, and thus a vast majority of devices will be able to handle it. This can be verified by looking at some devices at_
+    However, in our application, the workgroup size and total number of shader invocations is relatively small, and images whose
+    storage buffers or workgroup counts would exceed the limits are split into tiles by processTiled(), and thus a vast majority of
+    devices will be able to handle it. This can be verified by looking at some devices at_
     http://vulkan.gpuinfo.org/
 
     Therefore, to keep things simple and clean, we will not perform any such checks here, and just pick the first physical
@@ -299,6 +1770,9 @@ void ComputeApplication::findPhysicalDevice() {
             break;
         }
     }
+
+    //keep the limits around, the tiled blur checks its shared memory use against them
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
 }
 
 // Returns the index of a queue family that supports compute operations. 
@@ -346,333 +1820,1051 @@ void ComputeApplication::createDevice() {
     // Specify any desired device features here. We do not need any for this application, though.
     VkPhysicalDeviceFeatures deviceFeatures = {};
 
+    /*
+    VK_EXT_external_memory_host is optional. With it, the loaded image is imported as a buffer and the
+    GPU copies it to the input buffer, without the CPU touching the pixels. It needs Vulkan 1.1 for
+    vkGetPhysicalDeviceProperties2, which reports the alignment imported pointers must have.
+    */
+    std::vector<const char*> deviceExtensions;
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, NULL);
+    std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, extensionProperties.data());
+    for (VkExtensionProperties prop : extensionProperties) {
+        if (strcmp(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME, prop.extensionName) == 0 &&
+            deviceProperties.apiVersion >= VK_API_VERSION_1_1) {
+            deviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+            externalMemoryHostSupported = true;
+        }
+    }
+
+    if (externalMemoryHostSupported) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+        hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &hostProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+        minImportedHostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
+    }
+
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.enabledLayerCount = (uint32_t)enabledLayers.size();  // need to specify validation layers here as well.
     deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
     deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo; // when creating the logical device, we also specify what queues it has.
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+    deviceCreateInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device)); // create logical device.
 
+    if (externalMemoryHostSupported) {
+        getMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+        externalMemoryHostSupported = getMemoryHostPointerProperties != NULL;
+    }
+
     uint32_t particularQueueIndex = 0;	//the index within this queue family of the queue to retrieve.
 
     // Get a handle to the only member of the queue family.
     vkGetDeviceQueue(device, queueFamilyIndex, particularQueueIndex, &computeQueue);
 }
 
-// find memory type with desired properties.
-uint32_t ComputeApplication::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
+void ComputeApplication::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+    VkBuffer& buffer, Allocation& bufferMemory, VkMemoryPropertyFlags preferredProperties) {
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size; // buffer size in bytes. 
+    bufferCreateInfo.usage = usage;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // buffer is exclusive to a single queue family at a time. 
 
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL, &buffer)); // create buffer.
 
     /*
-    How does this search work?
-    See the documentation of VkPhysicalDeviceMemoryProperties for a detailed description. 
+    But the buffer doesn't allocate memory for itself, so we must do that manually.
+    First, we find the memory requirements for the buffer.
     */
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-        //if this memory type's index is set inside memoryTypeBits and it has all the specified properties
-        if ((memoryTypeBits & (1 << i)) &&
-            ((memoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
-            return i;
-    }
-    return -1;
-}
-
-void ComputeApplication::createInputBuffer() {
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+    
     /*
-    We will now create a buffer. We will render the mandelbrot set into this buffer
-    in a computer shade later. 
+    Now use obtained memory requirements info to get memory for the buffer. The allocator places it
+    in a larger block of the memory type, at the alignment the buffer requires.
+    The preferred properties are only used when some memory type has them, e.g. host cached
+    memory makes reading the output back on the CPU much faster.
     */
+    bufferMemory = allocator.allocate(memoryRequirements, properties, preferredProperties);
     
-    VkBufferCreateInfo inputBufferCreateInfo = {};
-    inputBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    inputBufferCreateInfo.size = imageSize; // buffer size in bytes. 
-    inputBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; // buffer is used as a storage buffer.
-    inputBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // buffer is exclusive to a single queue family at a time. 
+    // Now associate that memory with the buffer. With that, the buffer is backed by actual memory. 
+    VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset));
+}
+
+void ComputeApplication::destroyBuffer(VkBuffer& buffer, Allocation& bufferMemory) {
+    vkDestroyBuffer(device, buffer, NULL);
+    allocator.free(bufferMemory);
+}
 
-    VK_CHECK_RESULT(vkCreateBuffer(device, &inputBufferCreateInfo, NULL, &inputBuffer)); // create buffer.
+void ComputeApplication::detectUnifiedMemory() {
 
     /*
-    But the buffer doesn't allocate memory for itself, so we must do that manually.
+    On integrated GPUs, CPU implementations like lavapipe and discrete GPUs with resizable BAR,
+    the whole device local heap is also host visible. The shader then reads mapped memory at full
+    speed and staging copies would only cost time.
+
+    A discrete GPU without resizable BAR only exposes a small (usually 256MB) window of its
+    memory to the host, so there we keep the image in device local memory and copy through staging buffers.
     */
+    const VkPhysicalDeviceMemoryProperties& memoryProperties = allocator.getMemoryProperties();
+
+    VkDeviceSize largestDeviceLocalHeap = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            largestDeviceLocalHeap = max(largestDeviceLocalHeap, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+
+    VkMemoryPropertyFlags mappable = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    useStagingBuffers = true;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        const VkMemoryType& type = memoryProperties.memoryTypes[i];
+        if ((type.propertyFlags & mappable) == mappable &&
+            memoryProperties.memoryHeaps[type.heapIndex].size * 2 >= largestDeviceLocalHeap) {
+            useStagingBuffers = false;
+            break;
+        }
+    }
+
+    if (verbose) {
+        cout << (useStagingBuffers ? "using staging buffers for device local memory" : "device local memory is host visible, mapping it directly") << endl;
+    }
+}
+
+void ComputeApplication::reserveImageBuffers(Frame& frame) {
+
+    if (frame.imageSize <= frame.imageCapacity && frame.intermediateSize <= frame.intermediateCapacity) {
+        return;
+    }
+
+    //the previous job of this frame has finished (its fence was waited on), so the old buffers can go
+    if (frame.imageCapacity != 0) {
+        destroyImageBuffers(frame);
+    }
+
+    frame.imageCapacity = frame.imageSize;
+    frame.intermediateCapacity = frame.intermediateSize;
+    if (verbose) {
+        cout << "allocating image buffers for " << frame.imageWidth << "x" << frame.imageHeight << endl;
+    }
+
+    createInputBuffer(frame);
+	createOutputBuffer(frame);
+    createIntermediateBuffer(frame);
+
+    //point the descriptor set at the new buffers
+    updateDescriptorSet(frame);
+}
+
+void ComputeApplication::reserveBoxBuffer(Frame& frame) {
+
+    if (frame.boxCapacity >= frame.intermediateSize) {
+        return;
+    }
+    if (frame.boxCapacity != 0) {
+        destroyBuffer(frame.boxBuffer, frame.boxBufferMemory);
+    }
+
+    //as large as the intermediate buffer, so it only grows with it
+    frame.boxCapacity = frame.intermediateCapacity;
+    createBuffer(frame.boxCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        frame.boxBuffer, frame.boxBufferMemory);
+    updateDescriptorSet(frame);
+}
+
+void ComputeApplication::destroyImageBuffers(Frame& frame) {
+
+    //free input image
+    destroyBuffer(frame.inputBuffer, frame.inputBufferMemory);
+
+	//free export image
+	destroyBuffer(frame.outputBuffer, frame.outputBufferMemory);
+
+    //free staging copies
+    if (useStagingBuffers) {
+        destroyBuffer(frame.inputStagingBuffer, frame.inputStagingBufferMemory);
+        destroyBuffer(frame.outputStagingBuffer, frame.outputStagingBufferMemory);
+    }
+
+    //free intermediate image
+    destroyBuffer(frame.intermediateBuffer, frame.intermediateBufferMemory);
+
+    //free the box blur buffer, the next box blur job creates it at the new size
+    if (frame.boxCapacity != 0) {
+        destroyBuffer(frame.boxBuffer, frame.boxBufferMemory);
+        frame.boxCapacity = 0;
+    }
+}
 
+void ComputeApplication::createInputBuffer(Frame& frame) {
     /*
-    First, we find the memory requirements for the buffer.
+    We will now create a buffer. The input image will be uploaded into this buffer
+    and read by the compute shader. 
     */
-    VkMemoryRequirements memoryRequirements;
-    vkGetBufferMemoryRequirements(device, inputBuffer, &memoryRequirements);
-    
+    if (!useStagingBuffers) {
+        //also a copy destination for imported inputs
+        createBuffer(frame.imageCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            frame.inputBuffer, frame.inputBufferMemory);
+        frame.inputHostPointer = frame.inputBufferMemory.mapped;
+        return;
+    }
+
+    //the shader reads device local memory, the CPU writes a host visible copy that is transferred in the command buffer
+    createBuffer(frame.imageCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.inputBuffer, frame.inputBufferMemory);
+    createBuffer(frame.imageCapacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.inputStagingBuffer, frame.inputStagingBufferMemory);
+    frame.inputHostPointer = frame.inputStagingBufferMemory.mapped;
+}
+
+bool ComputeApplication::importInput(Frame& frame, const Image& input) {
+
     /*
-    Now use obtained memory requirements info to allocate the memory for the buffer.
+    Only RGBA8 has the buffer layout of the loaded pixels, the other formats are converted while writing.
+    The pointer has to be aligned to minImportedHostPointerAlignment, and the imported size is rounded up
+    to it. Memory mapped files and large decoded images start on a page boundary, and as long as the
+    alignment is not larger than a page, the rounded up end stays inside the last page of the pixels.
     */
+#ifdef _WIN32
+    return false;
+#else
+    long pageSize = sysconf(_SC_PAGESIZE);
+    VkDeviceSize alignment = minImportedHostPointerAlignment;
+    if (!externalMemoryHostSupported || pixelFormat != PIXEL_FORMAT_RGBA8 || !input.external ||
+        alignment == 0 || pageSize <= 0 || alignment > (VkDeviceSize)pageSize ||
+        (uintptr_t)input.external.get() % alignment != 0) {
+        return false;
+    }
+    void* hostPointer = (void*)input.external.get();
+    VkDeviceSize inputSize = (VkDeviceSize)4 * input.width * input.height;
+    VkDeviceSize importSize = (inputSize + alignment - 1) / alignment * alignment;
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (getMemoryHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostPointer, &pointerProperties) != VK_SUCCESS) {
+        return false;
+    }
+
+    VkExternalMemoryBufferCreateInfo externalCreateInfo = {};
+    externalCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.pNext = &externalCreateInfo;
+    bufferCreateInfo.size = inputSize;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL, &frame.importedInputBuffer));
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, frame.importedInputBuffer, &memoryRequirements);
+    uint32_t memoryType = allocator.findMemoryType(memoryRequirements.memoryTypeBits & pointerProperties.memoryTypeBits, 0);
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = hostPointer;
+
     VkMemoryAllocateInfo allocateInfo = {};
     allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize = memoryRequirements.size; // specify required memory.
+    allocateInfo.pNext = &importInfo;
+    allocateInfo.allocationSize = max(importSize, memoryRequirements.size);
+    allocateInfo.memoryTypeIndex = memoryType;
+
+    //some drivers refuse some kinds of host memory, e.g. file mappings, then the pixels are copied as usual
+    if (memoryType == (uint32_t)-1 || allocateInfo.allocationSize > importSize ||
+        vkAllocateMemory(device, &allocateInfo, NULL, &frame.importedInputMemory) != VK_SUCCESS) {
+        vkDestroyBuffer(device, frame.importedInputBuffer, NULL);
+        frame.importedInputBuffer = VK_NULL_HANDLE;
+        return false;
+    }
+    VK_CHECK_RESULT(vkBindBufferMemory(device, frame.importedInputBuffer, frame.importedInputMemory, 0));
+
+    frame.importedPixels = input.external;
+    return true;
+#endif
+}
+
+void ComputeApplication::releaseImportedInput(Frame& frame) {
+
+    if (frame.importedInputBuffer == VK_NULL_HANDLE) {
+        return;
+    }
+    vkDestroyBuffer(device, frame.importedInputBuffer, NULL);
+    vkFreeMemory(device, frame.importedInputMemory, NULL);
+    frame.recorded.valid = false;
+    frame.importedInputBuffer = VK_NULL_HANDLE;
+    frame.importedInputMemory = VK_NULL_HANDLE;
+    frame.importedPixels.reset();
+}
+
+// Writes RGBA8 pixels to an input buffer in its pixel format.
+static void convertPixels(const unsigned char* inputImageData, void* mappedMemory, size_t pixelCount, PixelFormat format) {
+
+    if (format == PIXEL_FORMAT_RGBA8) {
+        // the shader unpacks the bytes itself
+        memcpy(mappedMemory, inputImageData, pixelCount * 4);
+    }
+    else if (format == PIXEL_FORMAT_RGBA16F) {
+        uint16_t* halfPointer = (uint16_t*)mappedMemory;
+        for (size_t i = 0; i < pixelCount * 4; i += 1) {
+            halfPointer[i] = floatToHalf((float)inputImageData[i]);
+        }
+    }
+    else {
+        Color* pixelPointer = (Color*)mappedMemory;
+
+        for (size_t i = 0; i < pixelCount; i += 1) {
+            pixelPointer[i].r = (float)inputImageData[i * 4 + 0];
+            pixelPointer[i].g = (float)inputImageData[i * 4 + 1];
+            pixelPointer[i].b = (float)inputImageData[i * 4 + 2];
+            pixelPointer[i].a = (float)inputImageData[i * 4 + 3];
+        }
+    }
+}
+
+void ComputeApplication::writeToInputBuffer(Frame& frame, const Image& input, uint32_t firstRow, uint32_t rowCount){
+
+    //host coherent and mapped for as long as the buffer lives, so just write
+    unsigned char* mappedMemory = (unsigned char*)frame.inputHostPointer;
+    size_t rowPixels = frame.imageWidth;
+    size_t pixelSize = bytesPerPixel(pixelFormat);
+    PixelFormat format = pixelFormat;
+
+    //Strips of rows are written on all cores. Streamed images are decoded right here, into the
+    //buffer itself for RGBA8, or into a strip sized buffer first that is then converted.
+    rowCount = min(rowCount, frame.imageHeight - firstRow);
+    uploadPool.parallelFor(rowCount, [&](size_t begin, size_t end) {
+        begin += firstRow;
+        end += firstRow;
+        unsigned char* destination = mappedMemory + begin * rowPixels * pixelSize;
+        size_t pixelCount = (end - begin) * rowPixels;
+        if (input.decoded()) {
+            convertPixels(input.data() + begin * rowPixels * 4, destination, pixelCount, format);
+        }
+        else if (format == PIXEL_FORMAT_RGBA8) {
+            input.decodeRows((uint32_t)begin, (uint32_t)(end - begin), destination);
+        }
+        else {
+            std::vector<unsigned char> strip(pixelCount * 4);
+            input.decodeRows((uint32_t)begin, (uint32_t)(end - begin), strip.data());
+            convertPixels(strip.data(), destination, pixelCount, format);
+        }
+    });
+}
+
+void ComputeApplication::createOutputBuffer(Frame& frame) {
+
+    if (!useStagingBuffers) {
+        createBuffer(frame.imageCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            frame.outputBuffer, frame.outputBufferMemory, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        frame.outputHostPointer = frame.outputBufferMemory.mapped;
+        return;
+    }
+
+    //the shader writes device local memory, which is copied back to a host visible buffer in the command buffer
+    createBuffer(frame.imageCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.outputBuffer, frame.outputBufferMemory);
+    createBuffer(frame.imageCapacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.outputStagingBuffer, frame.outputStagingBufferMemory,
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    frame.outputHostPointer = frame.outputStagingBufferMemory.mapped;
+}
+
+void ComputeApplication::createIntermediateBuffer(Frame& frame) {
+
+    //full float pixels whatever the pixel format, never mapped by the CPU
+    createBuffer(frame.intermediateCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        frame.intermediateBuffer, frame.intermediateBufferMemory);
+}
+
+void ComputeApplication::createWeightBuffer(Frame& frame, VkDeviceSize size) {
+
+    frame.weightBufferCapacity = size;
+
+    //small buffer written by the host when the blur size changes, read by every invocation
+    createBuffer(frame.weightBufferCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, frame.weightBuffer, frame.weightBufferMemory);
+}
+
+void ComputeApplication::writeToWeightBuffer(Frame& frame, int32_t blur) {
+
+    //same table as the last job, nothing to do
+    if (blur == frame.weightBufferBlur) {
+        return;
+    }
+
+    std::vector<float> weights = computeGaussWeights(blur);
+    VkDeviceSize weightsSize = sizeof(float) * weights.size();
+
+    //grow the table for a larger blur window
+    if (weightsSize > frame.weightBufferCapacity) {
+        if (frame.weightBufferCapacity != 0) {
+            destroyBuffer(frame.weightBuffer, frame.weightBufferMemory);
+        }
+        createWeightBuffer(frame, weightsSize);
+        updateDescriptorSet(frame);
+    }
+
+    memcpy(frame.weightBufferMemory.mapped, weights.data(), (size_t)weightsSize);
+
+    frame.weightBufferBlur = blur;
+}
+
+void ComputeApplication::writeToGraphBuffer(Frame& frame, const FilterParams& params) {
+
     /*
-    There are several types of memory that can be allocated, and we must choose a memory type that:
-
-    1) Satisfies the memory requirements(memoryRequirements.memoryTypeBits). 
-    2) Satifies our own usage requirements. We want to be able to read the buffer memory from the GPU to the CPU
-       with vkMapMemory, so we set VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT. 
-    Also, by setting VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memory written by the device(GPU) will be easily 
-    visible to the host(CPU), without having to call any extra flushing commands. So mainly for convenience, we set
-    this flag.
+    Every pass gets the gaussian of its blur, four weights to a vec4, and the list of its per pixel
+    operations: a header with the operation and the number of vec4s after its values, the values,
+    and for a LUT the 256 entries. Where they start is pushed with the pass.
     */
-    allocateInfo.memoryTypeIndex = findMemoryType(
-        memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    std::vector<float> data;
+    const std::vector<FilterOp>& ops = params.graph->operations();
+    frame.graphOpStarts.clear();
+    frame.graphWeightStarts.clear();
+    for (size_t i = 0; i < frame.graphPasses.size(); ++i) {
+        const FilterPass& pass = frame.graphPasses[i];
+
+        frame.graphWeightStarts.push_back((uint32_t)(data.size() / 4));
+        if (pass.blurSize != 0) {
+            std::vector<float> weights = computeGaussWeights(pass.blurSize);
+            weights.resize((weights.size() + 3) / 4 * 4, 0.0f);
+            data.insert(data.end(), weights.begin(), weights.end());
+        }
+
+        frame.graphOpStarts.push_back((uint32_t)(data.size() / 4));
+        for (size_t j = 0; j < pass.pointOps.size(); ++j) {
+            const FilterOp& op = ops[pass.pointOps[j]];
+            float header[4] = { (float)op.type, (float)(op.lut.size() / 4), 0.0f, 0.0f };
+            data.insert(data.end(), header, header + 4);
+            data.insert(data.end(), op.values, op.values + 4);
+            data.insert(data.end(), op.lut.begin(), op.lut.end());
+        }
+    }
+
+    //same graph as the last job, the data only depends on the graph itself
+    if (params.graph == frame.graphBufferGraph) {
+        return;
+    }
+
+    //grow the buffer for a larger graph, never empty so the descriptor stays valid
+    VkDeviceSize dataSize = sizeof(float) * max(data.size(), (size_t)4);
+    if (dataSize > frame.graphBufferCapacity) {
+        if (frame.graphBufferCapacity != 0) {
+            destroyBuffer(frame.graphBuffer, frame.graphBufferMemory);
+        }
+        frame.graphBufferCapacity = dataSize;
+        createBuffer(frame.graphBufferCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, frame.graphBuffer, frame.graphBufferMemory);
+        updateDescriptorSet(frame);
+    }
+
+    if (!data.empty()) {
+        memcpy(frame.graphBufferMemory.mapped, data.data(), sizeof(float) * data.size());
+    }
+    frame.graphBufferGraph = params.graph;
+}
+
+void ComputeApplication::createDescriptorSetLayout() {
 
-    VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &inputBufferMemory)); // allocate memory on device.
+
+    //define a single binding for a storage buffer
+    VkDescriptorSetLayoutBinding storageBufferBinding = {};
+    storageBufferBinding.binding = 0; // binding = 0
+    storageBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    storageBufferBinding.descriptorCount = 1;
+    storageBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //binding 1 used to be the uniform buffer, the per job settings are push constants now
+
+	//define a binding for a storage buffer
+	VkDescriptorSetLayoutBinding outputBufferBinding = {};
+	outputBufferBinding.binding = 2;	//binding = 2
+	outputBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	outputBufferBinding.descriptorCount = 1;
+	outputBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //define a binding for the intermediate storage buffer of the separable blur
+    VkDescriptorSetLayoutBinding intermediateBufferBinding = {};
+    intermediateBufferBinding.binding = 3;	//binding = 3
+    intermediateBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    intermediateBufferBinding.descriptorCount = 1;
+    intermediateBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //define a binding for the gaussian weight table
+    VkDescriptorSetLayoutBinding weightBufferBinding = {};
+    weightBufferBinding.binding = 4;	//binding = 4
+    weightBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    weightBufferBinding.descriptorCount = 1;
+    weightBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //define a binding for the second float buffer of the box blur
+    VkDescriptorSetLayoutBinding boxBufferBinding = {};
+    boxBufferBinding.binding = 5;	//binding = 5
+    boxBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    boxBufferBinding.descriptorCount = 1;
+    boxBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //define a binding for the operations of the filter graph
+    VkDescriptorSetLayoutBinding graphBufferBinding = {};
+    graphBufferBinding.binding = 6;	//binding = 6
+    graphBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    graphBufferBinding.descriptorCount = 1;
+    graphBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //put all bindings in an array
+    std::array<VkDescriptorSetLayoutBinding, 6> allBindings = {storageBufferBinding, outputBufferBinding, intermediateBufferBinding, weightBufferBinding, boxBufferBinding, graphBufferBinding };
+
+    //create descriptor set layout for binding to six storage buffers
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = (uint32_t)allBindings.size(); //number of bindings
+    descriptorSetLayoutCreateInfo.pBindings = allBindings.data();
+
+    // Create the descriptor set layout. 
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, NULL, &descriptorSetLayout));
+}
+
+void ComputeApplication::createDescriptorSet() {
     
-    // Now associate that allocated memory with the buffer. With that, the buffer is backed by actual memory. 
-    VK_CHECK_RESULT(vkBindBufferMemory(device, inputBuffer, inputBufferMemory, 0));
+    //So we will allocate a descriptor set here.
+    //But we need to first create a descriptor pool to do that. 
+   
+    //Our descriptor pool holds one set of 6 storage buffer descriptors per frame,
+    //and one for the frame of processIncremental().
+    uint32_t frameCount = (uint32_t)frames.size() + 1;
+   
+    std::array<VkDescriptorPoolSize, 1> poolSizes = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = 6 * frameCount;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = frameCount; // one descriptor set for every frame.
+    descriptorPoolCreateInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
+
+    //Create descriptor pool.
+    VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, NULL, &descriptorPool));
+
+
+    //With the pool allocated, we can now allocate the descriptor sets. 
+    for (size_t i = 0; i < frames.size(); ++i) {
+        VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+        descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; 
+        descriptorSetAllocateInfo.descriptorPool = descriptorPool; // pool to allocate from.
+        descriptorSetAllocateInfo.descriptorSetCount = 1; // allocate a single descriptor set.
+        descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
+
+        // allocate descriptor set.
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &frames[i].descriptorSet));
+    }
 }
 
-void ComputeApplication::writeToInputBuffer(){
+void ComputeApplication::updateDescriptorSet(Frame& frame) {
+
+    /*
+    Next, we need to connect our actual storage buffer with the descrptor. 
+    We use vkUpdateDescriptorSets() to update the descriptor set.
+    This runs again whenever a buffer is reallocated. The ranges cover whole buffers,
+    so smaller images reuse the same descriptors.
+    */
+
+    //commands recorded with the old buffers must not be submitted again
+    frame.recorded.valid = false;
+
+    // Specify the input buffer to bind to the descriptor.
+    VkDescriptorBufferInfo storageBufferInfo = {};
+    storageBufferInfo.buffer = frame.inputBuffer;
+    storageBufferInfo.offset = 0;
+    storageBufferInfo.range = VK_WHOLE_SIZE;
+
+	// Specify the output buffer to bind to the descriptor
+	VkDescriptorBufferInfo outputBufferInfo = {};
+	outputBufferInfo.buffer = frame.outputBuffer;
+	outputBufferInfo.offset = 0;
+	outputBufferInfo.range = VK_WHOLE_SIZE;
+
+    // Specify the intermediate buffer to bind to the descriptor
+    VkDescriptorBufferInfo intermediateBufferInfo = {};
+    intermediateBufferInfo.buffer = frame.intermediateBuffer;
+    intermediateBufferInfo.offset = 0;
+    intermediateBufferInfo.range = VK_WHOLE_SIZE;
+
+    // Specify the weight table to bind to the descriptor
+    VkDescriptorBufferInfo weightBufferInfo = {};
+    weightBufferInfo.buffer = frame.weightBuffer;
+    weightBufferInfo.offset = 0;
+    weightBufferInfo.range = VK_WHOLE_SIZE;
 
-    void* mappedMemory;
 
-    vkMapMemory(device, inputBufferMemory, 0, imageSize, 0, &mappedMemory);
+    std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = frame.descriptorSet; // write to this descriptor set.
+    descriptorWrites[0].dstBinding = 0; // write to the first, and only binding.
+    descriptorWrites[0].descriptorCount = 1; // update a single descriptor.
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
+    descriptorWrites[0].pBufferInfo = &storageBufferInfo;
+
+	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[1].dstSet = frame.descriptorSet; // write to this descriptor set.
+	descriptorWrites[1].dstBinding = 2; // write to the output binding.
+	descriptorWrites[1].descriptorCount = 1; // update a single descriptor.
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
+	descriptorWrites[1].pBufferInfo = &outputBufferInfo;
+
+    descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[2].dstSet = frame.descriptorSet;
+    descriptorWrites[2].dstBinding = 3;
+    descriptorWrites[2].descriptorCount = 1;
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[2].pBufferInfo = &intermediateBufferInfo;
+
+    descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[3].dstSet = frame.descriptorSet;
+    descriptorWrites[3].dstBinding = 4;
+    descriptorWrites[3].descriptorCount = 1;
+    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[3].pBufferInfo = &weightBufferInfo;
 
-    Color* pixelPointer = (Color*)mappedMemory;
+    // perform the update of the descriptor set.
+    vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(), 0, NULL);
 
-    for (uint32_t i = 0; i < OUTPUT_WIDTH * OUTPUT_HEIGHT; i += 1) {
-        pixelPointer[i].r = (float)inputImageData[i * 4 + 0];
-        pixelPointer[i].g = (float)inputImageData[i * 4 + 1];
-        pixelPointer[i].b = (float)inputImageData[i * 4 + 2];
-        pixelPointer[i].a = (float)inputImageData[i * 4 + 3];
+    //Only the box blur and graph kernels use binding 5, and only once such a job created the buffer.
+    //A descriptor no kernel of the pipeline uses may stay unwritten.
+    if (frame.boxCapacity != 0) {
+        VkDescriptorBufferInfo boxBufferInfo = {};
+        boxBufferInfo.buffer = frame.boxBuffer;
+        boxBufferInfo.offset = 0;
+        boxBufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet boxWrite = {};
+        boxWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        boxWrite.dstSet = frame.descriptorSet;
+        boxWrite.dstBinding = 5;
+        boxWrite.descriptorCount = 1;
+        boxWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        boxWrite.pBufferInfo = &boxBufferInfo;
+        vkUpdateDescriptorSets(device, 1, &boxWrite, 0, NULL);
     }
 
-    // Done reading, so unmap.
-    vkUnmapMemory(device, inputBufferMemory);
+    //binding 6 likewise, once the first filter graph job created its buffer
+    if (frame.graphBufferCapacity != 0) {
+        VkDescriptorBufferInfo graphBufferInfo = {};
+        graphBufferInfo.buffer = frame.graphBuffer;
+        graphBufferInfo.offset = 0;
+        graphBufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet graphWrite = {};
+        graphWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        graphWrite.dstSet = frame.descriptorSet;
+        graphWrite.dstBinding = 6;
+        graphWrite.descriptorCount = 1;
+        graphWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        graphWrite.pBufferInfo = &graphBufferInfo;
+        vkUpdateDescriptorSets(device, 1, &graphWrite, 0, NULL);
+    }
 }
-void ComputeApplication::createUniformBuffer(){
 
-    //buffer
-    VkBufferCreateInfo uniformBufferCreateInfo = {};
-    uniformBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    uniformBufferCreateInfo.size = sizeof(UniformBufferObject);
-    uniformBufferCreateInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-    uniformBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    VK_CHECK_RESULT(vkCreateBuffer(device, &uniformBufferCreateInfo, NULL, &uniformBuffer)); // create buffer.
 
-    //buffer memory
-    VkMemoryRequirements memoryRequirements;
-    vkGetBufferMemoryRequirements(device, uniformBuffer, &memoryRequirements);
+std::vector<char> ComputeApplication::readFile(const std::string& filename) {
 
-    VkMemoryAllocateInfo allocateInfo = {};
-    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize = memoryRequirements.size;
-    allocateInfo.memoryTypeIndex = findMemoryType(
-        memoryRequirements.memoryTypeBits,  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open file!");
+    }
+
+    size_t fileSize = (size_t) file.tellg();
+    std::vector<char> buffer(fileSize);
+
+    file.seekg(0);
+    file.read(buffer.data(), fileSize);
+
+    file.close();
 
-    //allocate memory on device
-    VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &uniformBufferMemory));
+    return buffer;
+}
+void ComputeApplication::createPipelineLayout() {
 
-    //bind buffer memory to buffer
-    VK_CHECK_RESULT(vkBindBufferMemory(device, uniformBuffer, uniformBufferMemory,0));
+    //The pipeline layout allows the pipeline to access descriptor sets. 
+    //So we just specify the descriptor set layout we created earlier.
+    //All of our kernels use the same bindings, so they share one layout.
+    //The per job settings are push constants, recorded into the command buffer with the dispatches.
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
 
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout; 
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
 }
 
+void ComputeApplication::createPipelineCache() {
 
-void ComputeApplication::writeToUniformBuffer(){
+    /*
+    Creating a pipeline compiles SPIR-V to the GPU's instruction set, which is by far the slowest
+    part of startup. The pipeline cache keeps the compiled code, and by saving it to disk in cleanup()
+    the next process starts from the result of this one.
+    */
+    std::vector<char> initialData;
+    pipelineCacheLoaded = false;
+    pipelineCacheLoadedSize = 0;
+    coldPipelineCreationTime = 0.0;
+    pipelineCreationTime = 0.0;
+    uncachedPipelineCreationTime = 0.0;
+
+    std::ifstream file(pipelineCacheFile, std::ios::ate | std::ios::binary);
+    if (!pipelineCacheFile.empty() && file.is_open()) {
+        size_t fileSize = (size_t)file.tellg();
+        file.seekg(0);
+
+        PipelineCacheFileHeader header = {};
+        if (fileSize >= sizeof(header)) {
+            file.read((char*)&header, sizeof(header));
+        }
+
+        //a cache of another GPU or driver would be rejected or, worse, misused by the driver
+        if (header.magic == PIPELINE_CACHE_MAGIC &&
+            header.vendorID == deviceProperties.vendorID &&
+            header.deviceID == deviceProperties.deviceID &&
+            header.driverVersion == deviceProperties.driverVersion &&
+            memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+            header.dataSize == fileSize - sizeof(header)) {
+
+            initialData.resize((size_t)header.dataSize);
+            file.read(initialData.data(), initialData.size());
+            pipelineCacheLoaded = true;
+            pipelineCacheLoadedSize = initialData.size();
+            coldPipelineCreationTime = header.coldCreationTime;
+        }
+        else {
+            cout << "ignoring pipeline cache " << pipelineCacheFile << ", it was written for another device or driver" << endl;
+        }
+    }
 
-    UniformBufferObject ubo;
-	
-	ubo.color = { 1.0f, 1.0f, 1.0f, 1.0f };
-	
-    ubo.width = OUTPUT_WIDTH;
-    ubo.height = OUTPUT_HEIGHT;
-    ubo.saturation = 1.7f;
-    ubo.blur = 51;
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheCreateInfo.initialDataSize = initialData.size();
+    pipelineCacheCreateInfo.pInitialData = initialData.empty() ? NULL : initialData.data();
+    VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, NULL, &pipelineCache));
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &pipelineCacheDataSize, NULL));
+}
 
-    void* mappedMemory;
+void ComputeApplication::savePipelineCache() {
 
-    vkMapMemory(device, uniformBufferMemory, 0, sizeof(ubo), 0, &mappedMemory);
+    if (pipelineCacheFile.empty()) {
+        return;
+    }
 
-    memcpy(mappedMemory, &ubo, sizeof(ubo));
+    size_t dataSize = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, NULL));
 
-    vkUnmapMemory(device, uniformBufferMemory);
+    //nothing was compiled that the file does not already hold
+    if (pipelineCacheLoaded && dataSize == pipelineCacheLoadedSize) {
+        return;
+    }
 
+    std::vector<char> data(dataSize);
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()));
+
+    PipelineCacheFileHeader header = {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.vendorID = deviceProperties.vendorID;
+    header.deviceID = deviceProperties.deviceID;
+    header.driverVersion = deviceProperties.driverVersion;
+    memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = dataSize;
+
+    //a warm run adds the pipelines the cache lacked to the cold time, the others it only loaded
+    header.coldCreationTime = pipelineCacheLoaded ? coldPipelineCreationTime + uncachedPipelineCreationTime : pipelineCreationTime;
+
+    //concurrent processes never read a half written cache
+    std::vector<char> contents((const char*)&header, (const char*)&header + sizeof(header));
+    contents.insert(contents.end(), data.begin(), data.end());
+    if (!writeFileReplacing(pipelineCacheFile, contents.data(), contents.size())) {
+        cout << "could not write pipeline cache " << pipelineCacheFile << endl;
+    }
 }
 
+void ComputeApplication::setWorkgroupProfileFile(const std::string& filename) {
+    workgroupProfileFile = filename;
+}
 
-void ComputeApplication::createOutputBuffer() {
-
-	//create output buffer
-	VkBufferCreateInfo outputBufferCreateInfo = {};
-	outputBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	outputBufferCreateInfo.size = imageSize;
-	outputBufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-	outputBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+std::string ComputeApplication::deviceProfileKey() const {
 
-	VK_CHECK_RESULT(vkCreateBuffer(device, &outputBufferCreateInfo, NULL, &outputBuffer));
+    //same identity as the pipeline cache header, a new driver may well change the fastest shape
+    std::ostringstream key;
+    key << std::hex << deviceProperties.vendorID << " " << deviceProperties.deviceID << " " << deviceProperties.driverVersion << " ";
+    for (int i = 0; i < VK_UUID_SIZE; ++i) {
+        key << (int)deviceProperties.pipelineCacheUUID[i] / 16 << (int)deviceProperties.pipelineCacheUUID[i] % 16;
+    }
+    return key.str();
+}
 
-	//create output buffer memory
-	VkMemoryRequirements memoryRequirements;
-	vkGetBufferMemoryRequirements(device, outputBuffer, &memoryRequirements);
+void ComputeApplication::loadWorkgroupProfile() {
 
-	VkMemoryAllocateInfo allocateInfo = {};
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocateInfo.allocationSize = memoryRequirements.size;
-	allocateInfo.memoryTypeIndex = findMemoryType(
-		memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-	);
+    std::ifstream file(workgroupProfileFile);
+    if (workgroupProfileFile.empty() || !file.is_open()) {
+        return;
+    }
 
-	VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &outputBufferMemory));
+    //each line is: vendorID deviceID driverVersion pipelineCacheUUID width height blur mode
+    std::string key = deviceProfileKey();
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) != 0) {
+            continue;
+        }
 
-	VK_CHECK_RESULT(vkBindBufferMemory(device, outputBuffer, outputBufferMemory, 0));
+        std::istringstream values(line.substr(key.size()));
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::string mode;
+        values >> width >> height >> mode;
+
+        //a profile edited by hand, or of another version of this program, must not break the dispatch
+        const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+        if (width == 0 || height == 0 || width > limits.maxComputeWorkGroupSize[0] || height > limits.maxComputeWorkGroupSize[1] ||
+            width * height > limits.maxComputeWorkGroupInvocations) {
+            cout << "ignoring invalid workgroup profile " << workgroupProfileFile << endl;
+            return;
+        }
 
+        workgroupWidth = width;
+        workgroupHeight = height;
+        tunedBlurMode = mode == blurModeName(BLUR_MODE_SEPARABLE) ? BLUR_MODE_SEPARABLE : BLUR_MODE_TILED;
+        if (verbose) {
+            cout << "using workgroup size " << workgroupWidth << "x" << workgroupHeight << " and the "
+                << blurModeName(tunedBlurMode) << " blur from " << workgroupProfileFile << endl;
+        }
+        return;
+    }
 }
-void ComputeApplication::createDescriptorSetLayout() {
-
-
-    //define a single binding for a storage buffer
-    VkDescriptorSetLayoutBinding storageBufferBinding = {};
-    storageBufferBinding.binding = 0; // binding = 0
-    storageBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    storageBufferBinding.descriptorCount = 1;
-    storageBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
-    //define a binding for a UBO
-    VkDescriptorSetLayoutBinding uniformBufferBinding = {};
-    uniformBufferBinding.binding = 1;	//binding = 1
-    uniformBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uniformBufferBinding.descriptorCount = 1;
-    uniformBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+void ComputeApplication::saveWorkgroupProfile() {
 
-	//define a binding for a storage buffer
-	VkDescriptorSetLayoutBinding outputBufferBinding = {};
-	outputBufferBinding.binding = 2;	//binding = 2
-	outputBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	outputBufferBinding.descriptorCount = 1;
-	outputBufferBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    if (workgroupProfileFile.empty()) {
+        return;
+    }
 
-    //put all bindings in an array
-    std::array<VkDescriptorSetLayoutBinding, 3> allBindings = {storageBufferBinding, uniformBufferBinding, outputBufferBinding };
+    //keep the lines of the other devices
+    std::string key = deviceProfileKey();
+    std::vector<std::string> lines;
+    std::ifstream existing(workgroupProfileFile);
+    std::string line;
+    while (std::getline(existing, line)) {
+        if (!line.empty() && line.compare(0, key.size(), key) != 0) {
+            lines.push_back(line);
+        }
+    }
+    existing.close();
 
-    //create descriptor set layout for binding to a storage buffer, UBO and another storage buffer
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
-    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.bindingCount = 3; //number of bindings
-    descriptorSetLayoutCreateInfo.pBindings = allBindings.data();
+    std::ostringstream profile;
+    profile << key << " " << workgroupWidth << " " << workgroupHeight << " " << blurModeName(tunedBlurMode);
+    lines.push_back(profile.str());
 
-    // Create the descriptor set layout. 
-    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, NULL, &descriptorSetLayout));
+    std::string contents;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        contents += lines[i] + "\n";
+    }
+    if (!writeFileReplacing(workgroupProfileFile, contents.data(), contents.size())) {
+        cout << "could not write workgroup profile " << workgroupProfileFile << endl;
+    }
 }
 
-void ComputeApplication::createDescriptorSet() {
-    
-    //So we will allocate a descriptor set here.
-    //But we need to first create a descriptor pool to do that. 
-   
-    //Our descriptor pool can only allocate a single storage buffer.
-   
-    std::array<VkDescriptorPoolSize, 3> poolSizes = {};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[0].descriptorCount = 1;
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[1].descriptorCount = 1;
-	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSizes[2].descriptorCount = 1;
-
-    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
-    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolCreateInfo.maxSets = 1; // we only need to allocate one descriptor set from the pool.
-    descriptorPoolCreateInfo.poolSizeCount = 3; //3 descriptors total
-    descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
+double ComputeApplication::measureKernel(const Image& sample, const FilterParams& params, int repeat) {
 
-    //Create descriptor pool.
-    VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, NULL, &descriptorPool));
+    //the first run compiles the pipelines and grows the buffers
+    process(sample, params);
 
+    std::vector<double> times;
+    for (int i = 0; i < repeat; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        process(sample, params);
+        double time = millisecondsSince(start);
 
-    //With the pool allocated, we can now allocate the descriptor set. 
-    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO; 
-    descriptorSetAllocateInfo.descriptorPool = descriptorPool; // pool to allocate from.
-    descriptorSetAllocateInfo.descriptorSetCount = 1; // allocate a single descriptor set.
-    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
+        //the GPU time leaves out upload and readback, which do not depend on the workgroup size
+        const ImageTimings& timings = lastTimings();
+        for (size_t j = 0; j < timings.stages.size(); ++j) {
+            if (timings.stages[j].first == "gpu_total") {
+                time = timings.stages[j].second;
+            }
+        }
+        times.push_back(time);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
 
-    // allocate descriptor set.
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &descriptorSet));
+void ComputeApplication::autotune(const Image& sample, const FilterParams& params) {
 
     /*
-    Next, we need to connect our actual storage buffer with the descrptor. 
-    We use vkUpdateDescriptorSets() to update the descriptor set.
+    The blur is limited by memory bandwidth, and which workgroup shape reads memory best depends on the
+    device: wide rows suit the coalescing of most GPUs, small square groups suit caches and devices
+    with fewer invocations per workgroup. So rather than guess, time every shape the device supports.
     */
+    static const uint32_t candidates[][2] = {
+        { 8, 8 }, { 16, 8 }, { 16, 16 }, { 32, 4 }, { 32, 8 }, { 32, 16 }, { 32, 32 }, { 64, 4 }, { 128, 2 }
+    };
+    const int repeat = 5;
+
+    bool wasVerbose = verbose;
+    verbose = false;
+
+    //above the box blur radius every job runs the box kernels, which have a fixed shape as well, so the
+    //shapes are timed with the largest blur that still runs the separable or the tiled kernels
+    FilterParams separableParams = params;
+    separableParams.blurMode = BLUR_MODE_SEPARABLE;
+    separableParams.graph.reset();
+    if (boxBlurRadius > 0) {
+        separableParams.blur = min(params.blur, 2 * boxBlurRadius + 1);
+    }
 
-    // Specify the input buffer to bind to the descriptor.
-    VkDescriptorBufferInfo storageBufferInfo = {};
-    storageBufferInfo.buffer = inputBuffer;
-    storageBufferInfo.offset = 0;
-    storageBufferInfo.range = imageSize;
-
-    // Specify the uniform buffer info
-    VkDescriptorBufferInfo descriptorUniformBufferInfo = {};
-    descriptorUniformBufferInfo.buffer = uniformBuffer;
-    descriptorUniformBufferInfo.offset = 0;
-    descriptorUniformBufferInfo.range = sizeof(UniformBufferObject);
+    const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+    uint32_t bestWidth = workgroupWidth;
+    uint32_t bestHeight = workgroupHeight;
+    double bestTime = 0.0;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        uint32_t width = candidates[i][0];
+        uint32_t height = candidates[i][1];
+        if (width > limits.maxComputeWorkGroupSize[0] || height > limits.maxComputeWorkGroupSize[1] ||
+            width * height > limits.maxComputeWorkGroupInvocations) {
+            continue;
+        }
 
-	// Specify the output buffer to bind to the descriptor
-	VkDescriptorBufferInfo outputBufferInfo = {};
-	outputBufferInfo.buffer = outputBuffer;
-	outputBufferInfo.offset = 0;
-	outputBufferInfo.range = imageSize;
+        workgroupWidth = width;
+        workgroupHeight = height;
+        double time = measureKernel(sample, separableParams, repeat);
+        cout << "workgroup " << width << "x" << height << ": " << time << " ms" << endl;
+        if (bestTime == 0.0 || time < bestTime) {
+            bestTime = time;
+            bestWidth = width;
+            bestHeight = height;
+        }
+    }
+    workgroupWidth = bestWidth;
+    workgroupHeight = bestHeight;
+
+    //the tiled kernels have a fixed shape, they only compete against the best separable one
+    tunedBlurMode = BLUR_MODE_TILED;
+    FilterParams tiledParams = separableParams;
+    tiledParams.blurMode = BLUR_MODE_TILED;
+    if (resolveBlurMode(tiledParams) == BLUR_MODE_TILED) {
+        double tiledTime = measureKernel(sample, tiledParams, repeat);
+        cout << "tiled " << TILE_LENGTH << "x" << TILE_WIDTH << ": " << tiledTime << " ms" << endl;
+        if (bestTime < tiledTime) {
+            tunedBlurMode = BLUR_MODE_SEPARABLE;
+        }
+    }
 
+    verbose = wasVerbose;
+    cout << "autotune picked workgroup size " << workgroupWidth << "x" << workgroupHeight << " and the "
+        << blurModeName(tunedBlurMode) << " blur" << endl;
+    saveWorkgroupProfile();
+}
 
-    std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+VkPipeline ComputeApplication::getPipeline(const std::string& shaderName, int32_t blurSize) {
 
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = descriptorSet; // write to this descriptor set.
-    descriptorWrites[0].dstBinding = 0; // write to the first, and only binding.
-    descriptorWrites[0].descriptorCount = 1; // update a single descriptor.
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
-    descriptorWrites[0].pBufferInfo = &storageBufferInfo;
+    PipelineKey key;
+    key.shaderName = shaderName;
+    key.blurSize = blurSize;
+    key.workgroupWidth = workgroupWidth;
+    key.workgroupHeight = workgroupHeight;
 
-    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[1].dstSet = descriptorSet;
-    descriptorWrites[1].dstBinding = 1;
-    descriptorWrites[1].dstArrayElement = 0;	//??????
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[1].descriptorCount = 1;
-    descriptorWrites[1].pBufferInfo = &descriptorUniformBufferInfo;
-
-	descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[2].dstSet = descriptorSet; // write to this descriptor set.
-	descriptorWrites[2].dstBinding = 2; // write to the first, and only binding.
-	descriptorWrites[2].descriptorCount = 1; // update a single descriptor.
-	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
-	descriptorWrites[2].pBufferInfo = &outputBufferInfo;
+    //only compile the variants that jobs actually use, and each of them only once
+    std::map<PipelineKey, VkPipeline>::iterator found = pipelines.find(key);
+    if (found != pipelines.end()) {
+        return found->second;
+    }
 
-    // perform the update of the descriptor set.
-    vkUpdateDescriptorSets(device, (uint32_t)descriptorWrites.size(), descriptorWrites.data(), 0, NULL);
+    VkPipeline pipeline = createPipelineFromShader(key);
+    pipelines[key] = pipeline;
+    if (verbose && blurSize > 0) {
+        cout << "compiled " << shaderName << " for blur size " << blurSize << endl;
+    }
+    return pipeline;
 }
 
+bool ComputeApplication::usesBoxBlur(const FilterParams& params) const {
 
-std::vector<char> ComputeApplication::readFile(const std::string& filename) {
+    //graphs run their own blur passes
+    if (params.graph || params.blurMode == BLUR_MODE_GRAPH) {
+        return false;
+    }
+    if (params.blurMode == BLUR_MODE_BOX) {
+        return true;
+    }
+    return params.blurMode != BLUR_MODE_REFERENCE && boxBlurRadius > 0 && blurWindowSize(params.blur) / 2 > boxBlurRadius;
+}
 
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+BlurMode ComputeApplication::resolveBlurMode(const FilterParams& params) {
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
+    if (params.graph) {
+        return BLUR_MODE_GRAPH;
     }
 
-    size_t fileSize = (size_t) file.tellg();
-    std::vector<char> buffer(fileSize);
+    //large radii take the same time per pixel as small ones with the box blur
+    if (usesBoxBlur(params)) {
+        if (verbose && params.blurMode != BLUR_MODE_BOX) {
+            cout << "blur radius " << blurWindowSize(params.blur) / 2 << " uses the box blur, at most "
+                << boxBlurErrorBound(params.blur) << " levels off the gaussian" << endl;
+        }
+        return BLUR_MODE_BOX;
+    }
 
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
+    if (params.blurMode != BLUR_MODE_TILED) {
+        return params.blurMode;
+    }
 
-    file.close();
+    //the autotuner found the separable blur faster on this device
+    if (tunedBlurMode == BLUR_MODE_SEPARABLE) {
+        return BLUR_MODE_SEPARABLE;
+    }
 
-    return buffer;
+    //the tile holds TILE_WIDTH rows of TILE_LENGTH pixels plus the largest supported halo
+    uint32_t sharedMemorySize = sizeof(float) * 4 * TILE_WIDTH * (TILE_LENGTH + 2 * MAX_TILED_RADIUS);
+    uint32_t invocations = TILE_LENGTH * TILE_WIDTH;
+    int32_t radius = blurWindowSize(params.blur) / 2;
+
+    if (radius > MAX_TILED_RADIUS) {
+        if (verbose) {
+            cout << "blur radius " << radius << " does not fit the shared memory tile, using the separable blur" << endl;
+        }
+        return BLUR_MODE_SEPARABLE;
+    }
+    if (sharedMemorySize > deviceProperties.limits.maxComputeSharedMemorySize ||
+        invocations > deviceProperties.limits.maxComputeWorkGroupInvocations ||
+        (uint32_t)TILE_LENGTH > deviceProperties.limits.maxComputeWorkGroupSize[0] ||
+        (uint32_t)TILE_LENGTH > deviceProperties.limits.maxComputeWorkGroupSize[1]) {
+        cout << "device limits too small for the tiled blur, using the separable blur" << endl;
+        return BLUR_MODE_SEPARABLE;
+    }
+    return BLUR_MODE_TILED;
 }
-void ComputeApplication::createComputePipeline() {
 
-    
+VkPipeline ComputeApplication::createPipelineFromShader(const PipelineKey& key) {
+
     //Create a shader module. A shader module basically just encapsulates some shader code.
-    std::vector<char> shaderCode = readFile("resources/shaders/comp.spv");
+    std::vector<char> shaderCode = readFile("resources/shaders/" + key.shaderName + ".spv");
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
@@ -692,14 +2884,28 @@ void ComputeApplication::createComputePipeline() {
     shaderStageCreateInfo.module = computeShaderModule;
     shaderStageCreateInfo.pName = "main";
 
-    
-    //The pipeline layout allows the pipeline to access descriptor sets. 
-    //So we just specify the descriptor set layout we created earlier.
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = 1;
-    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout; 
-    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
+    /*
+    The pixel format is a specialization constant, so each pipeline only contains its own load and store path.
+    The blur size is one too, so the compiler can unroll the tap loops of common sizes, and the workgroup size
+    of the non tiled kernels. The tiled kernels do not declare the workgroup constants, so those entries are
+    ignored there.
+    */
+    uint32_t specializationData[4] = { (uint32_t)pixelFormat, (uint32_t)key.blurSize, key.workgroupWidth, key.workgroupHeight };
+
+    //PIXEL_FORMAT, BLUR_SIZE, WORKGROUP_SIZE_X_ID and WORKGROUP_SIZE_Y_ID in common.glsl
+    VkSpecializationMapEntry specializationEntries[4] = {};
+    for (uint32_t i = 0; i < 4; ++i) {
+        specializationEntries[i].constantID = i;
+        specializationEntries[i].offset = i * sizeof(uint32_t);
+        specializationEntries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 4;
+    specializationInfo.pMapEntries = specializationEntries;
+    specializationInfo.dataSize = sizeof(specializationData);
+    specializationInfo.pData = specializationData;
+    shaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
 
     VkComputePipelineCreateInfo pipelineCreateInfo = {};
     pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -707,11 +2913,25 @@ void ComputeApplication::createComputePipeline() {
     pipelineCreateInfo.layout = pipelineLayout;
 
     
-    //Now, we finally create the compute pipeline. 
-    VK_CHECK_RESULT(vkCreateComputePipelines( device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, NULL, &computePipeline));
+    //Now, we finally create the compute pipeline. With a warm pipeline cache this skips the compilation.
+    VkPipeline pipeline;
+    auto createStart = std::chrono::high_resolution_clock::now();
+    VK_CHECK_RESULT(vkCreateComputePipelines( device, pipelineCache, 1, &pipelineCreateInfo, NULL, &pipeline));
+    std::chrono::duration<double, std::milli> createTime = std::chrono::high_resolution_clock::now() - createStart;
+    pipelineCreationTime += createTime.count();
+
+    //the cache only grows for a pipeline it did not hold yet
+    size_t dataSize = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &dataSize, NULL));
+    if (dataSize != pipelineCacheDataSize) {
+        uncachedPipelineCreationTime += createTime.count();
+        pipelineCacheDataSize = dataSize;
+    }
 
     //don't need shader module anymore for any other pipeline, so destroy
     vkDestroyShaderModule(device, computeShaderModule, NULL);
+
+    return pipeline;
 }
 
 void ComputeApplication::createCommandBuffer() {
@@ -721,7 +2941,7 @@ void ComputeApplication::createCommandBuffer() {
     //To allocate a command buffer, we must first create a command pool. So let us do that.
     VkCommandPoolCreateInfo commandPoolCreateInfo = {};
     commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    commandPoolCreateInfo.flags = 0;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // the command buffer is re-recorded for every job.
 
     // the queue family of this command pool. All command buffers allocated from this command pool,
     // must be submitted to queues of this family ONLY. 
@@ -738,69 +2958,482 @@ void ComputeApplication::createCommandBuffer() {
     // A secondary buffer has to be called from some primary command buffer, and cannot be directly 
     // submitted to a queue. To keep things simple, we use a primary command buffer. 
     commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocateInfo.commandBufferCount = 1; // allocate a single command buffer. 
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer)); // allocate command buffer.
+    commandBufferAllocateInfo.commandBufferCount = 1; // allocate a single command buffer per frame. 
+
+    //Create a fence to make the CPU wait for the GPU to finish before proceeding 
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceCreateInfo.flags = 0;
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &frames[i].commandBuffer)); // allocate command buffer.
+        VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &frames[i].fence));
+    }
+}
+
+//push constants of a job over the whole image, the passes that need more change them before their dispatch
+static PushConstants jobPushConstants(const Frame& frame, const FilterParams& params) {
+
+    PushConstants pushConstants;
+    pushConstants.color = { params.color[0], params.color[1], params.color[2], params.color[3] };
+    pushConstants.width = frame.imageWidth;
+    pushConstants.height = frame.imageHeight;
+    pushConstants.saturation = params.saturation;
+    pushConstants.blur = params.blur;
+    pushConstants.boxRadius = 0;
+    pushConstants.boxPass = 0;
+    pushConstants.boxSegment = 0;
+    pushConstants.sourceWidth = frame.imageWidth;
+    pushConstants.sourceHeight = frame.imageHeight;
+    pushConstants.graphSource = GRAPH_BUFFER_INPUT;
+    pushConstants.graphTarget = GRAPH_BUFFER_OUTPUT;
+    pushConstants.graphStencil = FILTER_STENCIL_NONE;
+    pushConstants.graphAmount = 0.0f;
+    pushConstants.graphOpStart = 0;
+    pushConstants.graphOpCount = 0;
+    pushConstants.graphWeightStart = 0;
+    pushConstants.regionX = 0;
+    pushConstants.regionY = 0;
+    return pushConstants;
+}
+
+void ComputeApplication::createEditFrame() {
+
+    //the same resources as every frame of init(), from the same pools. The descriptor pool left room for its set.
+    createWeightBuffer(editFrame, sizeof(float) * (2 * MAX_TILED_RADIUS + 1));
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &editFrame.descriptorSet));
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &editFrame.commandBuffer));
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &editFrame.fence));
+
+    if (timestampsSupported) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = MAX_TIMESTAMPS;
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &editFrame.queryPool));
+    }
+    editFrameCreated = true;
+}
+
+void ComputeApplication::recordIncremental(Frame& frame, const FilterParams& params, const ImageRect& upload,
+    const ImageRect& horizontal, const ImageRect& vertical) {
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // the regions change with every call.
+    VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+
+    frame.timestampNames.clear();
+    if (timestampsSupported) {
+        vkCmdResetQueryPool(frame.commandBuffer, frame.queryPool, 0, MAX_TIMESTAMPS);
+    }
+    writeTimestamp(frame, "gpu_start");
+
+    vkCmdBindDescriptorSets(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, NULL);
+    PushConstants pushConstants = jobPushConstants(frame, params);
+    vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+    //the passes below read what the last call wrote to the float buffers
+    recordBufferBarrier(frame.commandBuffer, frame.intermediateBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    recordBufferBarrier(frame.commandBuffer, frame.boxBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    //only the changed rows go through the staging buffer
+    if (useStagingBuffers && !upload.empty()) {
+        VkDeviceSize rowSize = (VkDeviceSize)bytesPerPixel(pixelFormat) * frame.imageWidth;
+        VkBufferCopy uploadRegion = {};
+        uploadRegion.srcOffset = rowSize * upload.y;
+        uploadRegion.dstOffset = rowSize * upload.y;
+        uploadRegion.size = rowSize * upload.height;
+        vkCmdCopyBuffer(frame.commandBuffer, frame.inputStagingBuffer, frame.inputBuffer, 1, &uploadRegion);
+        writeTimestamp(frame, "gpu_upload");
+
+        recordBufferBarrier(frame.commandBuffer, frame.inputBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+
+    //the separable passes over their regions, the vertical one keeps its result in the box buffer
+    if (!horizontal.empty()) {
+        int32_t windowSize = blurWindowSize(params.blur);
+        int32_t specializedBlurSize = specializeBlurSize && windowSize <= MAX_SPECIALIZED_BLUR_SIZE ? windowSize : 0;
+        const char* shaderNames[2] = { "blurHorizontal", "blurVerticalRetained" };
+        const ImageRect* regions[2] = { &horizontal, &vertical };
+        for (int pass = 0; pass < 2; ++pass) {
+            const ImageRect& region = *regions[pass];
+            vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline(shaderNames[pass], specializedBlurSize));
+            uint32_t regionConstants[2] = { region.x, region.y };
+            vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                offsetof(PushConstants, regionX), sizeof(regionConstants), regionConstants);
+            vkCmdDispatch(frame.commandBuffer, (region.width + workgroupWidth - 1) / workgroupWidth,
+                (region.height + workgroupHeight - 1) / workgroupHeight, 1);
+            writeTimestamp(frame, pass == 0 ? "gpu_blur_horizontal" : "gpu_blur_vertical");
+
+            //the next pass reads what this one wrote
+            recordBufferBarrier(frame.commandBuffer, pass == 0 ? frame.intermediateBuffer : frame.boxBuffer,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        }
+    }
+
+    //tint, saturation and clamping always run over the whole image
+    vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline("finalColor", 0));
+    vkCmdDispatch(frame.commandBuffer, (frame.imageWidth + workgroupWidth - 1) / workgroupWidth,
+        (frame.imageHeight + workgroupHeight - 1) / workgroupHeight, 1);
+    writeTimestamp(frame, "gpu_final_color");
+
+    recordReadback(frame);
+
+    VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+
+    //recordCommandBuffer() did not record these commands
+    frame.recorded.valid = false;
+}
+
+void ComputeApplication::recordCommandBuffer(Frame& frame, const FilterParams& params) {
 
     /*
-    Now we shall start recording commands into the newly allocated command buffer. 
+    Now we shall start recording commands into the command buffer. 
+    Beginning implicitly resets what the previous job recorded.
     */
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // the buffer is only submitted and used once in this application.
-    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo)); // start recording commands.
+    beginInfo.flags = 0; // submitted again by later jobs of the same size and settings.
+    VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo)); // start recording commands.
+
+    //timestamp queries have to be reset before they are written again
+    frame.timestampNames.clear();
+    if (timestampsSupported) {
+        vkCmdResetQueryPool(frame.commandBuffer, frame.queryPool, 0, MAX_TIMESTAMPS);
+    }
+    writeTimestamp(frame, "gpu_start");
 
     /*
     We need to bind a pipeline, AND a descriptor set before we dispatch.
 
     The validation layer will NOT give warnings if you forget these, so be very careful not to forget them.
     */
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+    vkCmdBindDescriptorSets(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, NULL);
+
+    //The settings of this job go into the command buffer itself, no buffer to map and write.
+    //Every kernel shares the pipeline layout, so they stay valid across the pipeline binds below.
+    PushConstants pushConstants = jobPushConstants(frame, params);
+    vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+    //upload the image from the staging buffer, or the imported host memory, before any shader reads it
+    if (useStagingBuffers || frame.importedInputBuffer != VK_NULL_HANDLE) {
+        VkBufferCopy uploadRegion = {};
+        uploadRegion.size = (VkDeviceSize)bytesPerPixel(pixelFormat) * frame.imageWidth * frame.imageHeight;
+        VkBuffer source = frame.importedInputBuffer != VK_NULL_HANDLE ? frame.importedInputBuffer : frame.inputStagingBuffer;
+        vkCmdCopyBuffer(frame.commandBuffer, source, frame.inputBuffer, 1, &uploadRegion);
+        writeTimestamp(frame, "gpu_upload");
+
+        recordBufferBarrier(frame.commandBuffer, frame.inputBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
 
     /*
     Calling vkCmdDispatch basically starts the compute pipeline, and executes the compute shader.
     The number of workgroups is specified in the arguments.
     If you are already familiar with compute shaders from OpenGL, this should be nothing new to you.
     */
-    vkCmdDispatch(commandBuffer, (uint32_t)ceil(OUTPUT_WIDTH / float(WORKGROUP_SIZE)), (uint32_t)ceil(OUTPUT_HEIGHT / float(WORKGROUP_SIZE)), 1);
+    uint32_t groupCountX = (uint32_t)ceil(frame.imageWidth / float(workgroupWidth));
+    uint32_t groupCountY = (uint32_t)ceil(frame.imageHeight / float(workgroupHeight));
+
+    //the tiled passes cover TILE_LENGTH pixels along the blur direction per workgroup
+    uint32_t tileGroupsAlong = (uint32_t)ceil(frame.imageWidth / float(TILE_LENGTH));
+    uint32_t tileGroupsAcross = (uint32_t)ceil(frame.imageHeight / float(TILE_WIDTH));
+
+    if (frame.activeBlurMode == BLUR_MODE_GRAPH) {
+        /*
+        One dispatch per pass of the graph, each over the image it writes. The per pixel operations
+        run inside the passes, so only the stencils cost a trip through memory. The first pass reads
+        the input, the last one writes the output, and the ones in between alternate between the two
+        float buffers, so a pass never reads the buffer it writes.
+        */
+        vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline("graph", 0));
+        for (size_t i = 0; i < frame.graphPasses.size(); ++i) {
+            const FilterPass& pass = frame.graphPasses[i];
+            bool last = i + 1 == frame.graphPasses.size();
+            GraphBuffer target = last ? GRAPH_BUFFER_OUTPUT : (i % 2 == 0 ? GRAPH_BUFFER_A : GRAPH_BUFFER_B);
+
+            pushConstants.width = pass.width;
+            pushConstants.height = pass.height;
+            pushConstants.blur = pass.blurSize;
+            pushConstants.graphTarget = target;
+            pushConstants.graphStencil = pass.stencil;
+            pushConstants.graphAmount = pass.amount;
+            pushConstants.graphOpStart = frame.graphOpStarts[i];
+            pushConstants.graphOpCount = (uint32_t)pass.pointOps.size();
+            pushConstants.graphWeightStart = frame.graphWeightStarts[i];
+            vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+            vkCmdDispatch(frame.commandBuffer, (pass.width + workgroupWidth - 1) / workgroupWidth,
+                (pass.height + workgroupHeight - 1) / workgroupHeight, 1);
+
+            //the next pass reads what this one wrote, and writes the buffer this one read
+            if (!last) {
+                recordBufferBarrier(frame.commandBuffer, target == GRAPH_BUFFER_A ? frame.intermediateBuffer : frame.boxBuffer,
+                    VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+            }
+            pushConstants.sourceWidth = pass.width;
+            pushConstants.sourceHeight = pass.height;
+            pushConstants.graphSource = target;
+        }
+        writeTimestamp(frame, "gpu_graph");
+    }
+    else if (frame.activeBlurMode == BLUR_MODE_BOX) {
+        /*
+        Three box passes along the rows, then three along the columns, each reading what the pass
+        before it wrote. Only the box radius, the pass and the segment length change between them.
+        With segments at least as long as the window, summing the first window of a segment adds
+        at most one read per pixel.
+        */
+        int32_t radii[3];
+        computeBoxRadii(params.blur, radii);
+        for (uint32_t vertical = 0; vertical < 2; ++vertical) {
+            vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline(vertical ? "boxVertical" : "boxHorizontal", 0));
+            uint32_t lines = vertical ? frame.imageWidth : frame.imageHeight;
+            uint32_t lineLength = vertical ? frame.imageHeight : frame.imageWidth;
+
+            for (uint32_t pass = 0; pass < 3; ++pass) {
+                uint32_t segment = max((uint32_t)BOX_MIN_SEGMENT, (uint32_t)(2 * radii[pass] + 1));
+                uint32_t boxConstants[3] = { (uint32_t)radii[pass], pass, segment };
+                vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                    offsetof(PushConstants, boxRadius), sizeof(boxConstants), boxConstants);
+                vkCmdDispatch(frame.commandBuffer, (lines + BOX_GROUP_SIZE - 1) / BOX_GROUP_SIZE, (lineLength + segment - 1) / segment, 1);
+
+                //the next pass reads what this one wrote, the last one writes the output
+                if (vertical && pass == 2) {
+                    continue;
+                }
+                bool wroteBoxBuffer = vertical ? pass == 0 : pass == 1;
+                recordBufferBarrier(frame.commandBuffer, wroteBoxBuffer ? frame.boxBuffer : frame.intermediateBuffer,
+                    VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+            }
+            writeTimestamp(frame, vertical ? "gpu_box_vertical" : "gpu_box_horizontal");
+        }
+    }
+    else if (frame.activeBlurMode == BLUR_MODE_REFERENCE) {
+        vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline("shader", frame.specializedBlurSize));
+        vkCmdDispatch(frame.commandBuffer, groupCountX, groupCountY, 1);
+        writeTimestamp(frame, "gpu_blur");
+    }
+    else {
+        bool tiled = frame.activeBlurMode == BLUR_MODE_TILED;
+        vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline(tiled ? "blurHorizontalTiled" : "blurHorizontal", frame.specializedBlurSize));
+        if (frame.activeBlurMode == BLUR_MODE_TILED) {
+            vkCmdDispatch(frame.commandBuffer, tileGroupsAlong, tileGroupsAcross, 1);
+        }
+        else {
+            vkCmdDispatch(frame.commandBuffer, groupCountX, groupCountY, 1);
+        }
+        writeTimestamp(frame, "gpu_blur_horizontal");
+
+        //the vertical pass reads what the horizontal pass wrote, so wait for those writes
+        recordBufferBarrier(frame.commandBuffer, frame.intermediateBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, getPipeline(tiled ? "blurVerticalTiled" : "blurVertical", frame.specializedBlurSize));
+        if (frame.activeBlurMode == BLUR_MODE_TILED) {
+            vkCmdDispatch(frame.commandBuffer, (uint32_t)ceil(frame.imageWidth / float(TILE_WIDTH)), (uint32_t)ceil(frame.imageHeight / float(TILE_LENGTH)), 1);
+        }
+        else {
+            vkCmdDispatch(frame.commandBuffer, groupCountX, groupCountY, 1);
+        }
+        writeTimestamp(frame, "gpu_blur_vertical");
+    }
+
+    recordReadback(frame);
+
+    VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer)); // end recording commands.
 
-    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer)); // end recording commands.
+    RecordedCommands& recorded = frame.recorded;
+    recorded.valid = true;
+    recorded.width = frame.imageWidth;
+    recorded.height = frame.imageHeight;
+    recorded.params = params;
+    recorded.blurMode = frame.activeBlurMode;
+    recorded.specializedBlurSize = frame.specializedBlurSize;
+    recorded.workgroupWidth = workgroupWidth;
+    recorded.workgroupHeight = workgroupHeight;
 }
 
-void ComputeApplication::runCommandBuffer() {
+void ComputeApplication::recordReadback(Frame& frame) {
+
+    //copy the result back to the staging buffer, then make it visible to the CPU
+    if (useStagingBuffers) {
+        recordBufferBarrier(frame.commandBuffer, frame.outputBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        VkBufferCopy downloadRegion = {};
+        downloadRegion.size = (VkDeviceSize)bytesPerPixel(pixelFormat) * frame.outputWidth * frame.outputHeight;
+        vkCmdCopyBuffer(frame.commandBuffer, frame.outputBuffer, frame.outputStagingBuffer, 1, &downloadRegion);
+        writeTimestamp(frame, "gpu_readback");
+
+        recordBufferBarrier(frame.commandBuffer, frame.outputStagingBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+    }
+    else {
+        recordBufferBarrier(frame.commandBuffer, frame.outputBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+    }
+}
+
+void ComputeApplication::recordBufferBarrier(VkCommandBuffer commandBuffer, VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
+    VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask) {
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+void ComputeApplication::submitFrame(Frame& frame) {
 
     //Now we shall finally submit the recorded command buffer to a the compute queue.
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1; // submit a single command buffer
-    submitInfo.pCommandBuffers = &commandBuffer; // the command buffer to submit.
-
-    //Create a fence to make the CPU wait for the GPU to finish before proceeding 
-    VkFence fence;
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags = 0;
-    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
+    submitInfo.pCommandBuffers = &frame.commandBuffer; // the command buffer to submit.
 
     //We submit the command buffer on the queue, at the same time giving a fence.
-    VK_CHECK_RESULT(vkQueueSubmit(computeQueue, 1, &submitInfo, fence));
+    VK_CHECK_RESULT(vkQueueSubmit(computeQueue, 1, &submitInfo, frame.fence));
+    frame.inFlight = true;
+}
 
+void ComputeApplication::waitForFrame(Frame& frame) {
 
     /*The command will not have finished executing until the fence is signalled.
     So we wait here.
     We will directly after this read our buffer from the GPU,
     and we will not be sure that the command has finished executing unless we wait for the fence.
     Hence, we use a fence here.*/
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
+    VK_CHECK_RESULT(vkWaitForFences(device, 1, &frame.fence, VK_TRUE, 100000000000));
+
+    //unsignal the fence for the next job of this frame
+    VK_CHECK_RESULT(vkResetFences(device, 1, &frame.fence));
+    frame.inFlight = false;
+
+    //the GPU copied the imported input, the host memory can go
+    releaseImportedInput(frame);
+
+    readTimestamps(frame);
+}
+
+void ComputeApplication::createTimestampQueries() {
+
+    //not every queue can write timestamps, timestampValidBits is 0 then
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+    timestampsSupported = validBits != 0;
+    if (!timestampsSupported) {
+        cout << "compute queue does not support timestamps, only host timings are reported" << endl;
+        return;
+    }
+
+    //timestamps only count up in the low validBits, and one tick is timestampPeriod ns
+    timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+    timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = MAX_TIMESTAMPS;
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &frames[i].queryPool));
+    }
+}
+
+void ComputeApplication::writeTimestamp(Frame& frame, const std::string& stage) {
+
+    if (!timestampsSupported) {
+        return;
+    }
+
+    //the timestamp is written once everything recorded before it has finished,
+    //so the stage is the time between this timestamp and the previous one
+    assert(frame.timestampNames.size() < (size_t)MAX_TIMESTAMPS);
+    vkCmdWriteTimestamp(frame.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.queryPool, (uint32_t)frame.timestampNames.size());
+    frame.timestampNames.push_back(stage);
+}
+
+void ComputeApplication::readTimestamps(Frame& frame) {
+
+    if (!timestampsSupported || frame.timestampNames.size() < 2) {
+        return;
+    }
+
+    //the fence signalled, so all results are available
+    uint32_t count = (uint32_t)frame.timestampNames.size();
+    std::vector<uint64_t> ticks(count);
+    VK_CHECK_RESULT(vkGetQueryPoolResults(device, frame.queryPool, 0, count, ticks.size() * sizeof(uint64_t), ticks.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+
+    for (uint32_t i = 1; i < count; ++i) {
+        uint64_t elapsed = (ticks[i] - ticks[i - 1]) & timestampMask;
+        frame.timings.add(frame.timestampNames[i], elapsed * timestampPeriod / 1000000.0);
+    }
+    uint64_t total = (ticks[count - 1] - ticks[0]) & timestampMask;
+    frame.timings.add("gpu_total", total * timestampPeriod / 1000000.0);
+}
+
+void ComputeApplication::destroyFrame(Frame& frame) {
+
+    //a failed batch can leave frames running
+    if (frame.inFlight) {
+        waitForFrame(frame);
+    }
+    releaseImportedInput(frame);
+
+    //free image buffers, if any job ran on this frame
+    if (frame.imageCapacity != 0) {
+        destroyImageBuffers(frame);
+    }
+
+    //free gaussian weights
+    destroyBuffer(frame.weightBuffer, frame.weightBufferMemory);
 
-    //no longer need fence
-    vkDestroyFence(device, fence, NULL);
+    //free the filter graph operations, if any job used a graph
+    if (frame.graphBufferCapacity != 0) {
+        destroyBuffer(frame.graphBuffer, frame.graphBufferMemory);
+    }
+
+    vkDestroyFence(device, frame.fence, NULL);
+    if (timestampsSupported) {
+        vkDestroyQueryPool(device, frame.queryPool, NULL);
+    }
 }
 
 void ComputeApplication::cleanup() {
 	//clean up all Vulkan resources
 
-    if (enableValidationLayers) {
+    if (useValidationLayers) {
         // destroy callback.
         auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
         if (func == nullptr) {
@@ -809,28 +3442,31 @@ void ComputeApplication::cleanup() {
         func(instance, debugReportCallback, NULL);
     }
 
-    //free input image
-   	stbi_image_free(inputImageData);
-
-    //free export image
-    vkFreeMemory(device, inputBufferMemory, NULL);
-    vkDestroyBuffer(device, inputBuffer, NULL);  
-
-    //free uniform buffer
-    vkFreeMemory(device, uniformBufferMemory, NULL);
-    vkDestroyBuffer(device, uniformBuffer, NULL);
-
-	//free export image
-	vkFreeMemory(device, outputBufferMemory, NULL);
-	vkDestroyBuffer(device, outputBuffer, NULL);
+    for (size_t i = 0; i < frames.size(); ++i) {
+        destroyFrame(frames[i]);
+    }
+    frames.clear();
+    if (editFrameCreated) {
+        destroyFrame(editFrame);
+        editFrameCreated = false;
+        editBlur = 0;
+    }
 
 
     
     vkDestroyDescriptorPool(device, descriptorPool, NULL);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
     vkDestroyPipelineLayout(device, pipelineLayout, NULL);
-    vkDestroyPipeline(device, computePipeline, NULL);
+
+    //keep what was compiled for the next process
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, NULL);
+    for (std::map<PipelineKey, VkPipeline>::iterator it = pipelines.begin(); it != pipelines.end(); ++it) {
+        vkDestroyPipeline(device, it->second, NULL);
+    }
+    pipelines.clear();
     vkDestroyCommandPool(device, commandPool, NULL);        
+    allocator.cleanup();
     vkDestroyDevice(device, NULL);
     vkDestroyInstance(instance, NULL);              
 }
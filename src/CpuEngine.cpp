@@ -0,0 +1,183 @@
+#include "../include/CpuEngine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_ENGINE_SSE
+#include <emmintrin.h>
+#endif
+
+/*
+One RGBA pixel as 4 floats, the same as a vec4 in the shaders. With SSE each pixel is one register,
+so every operation below handles all four channels at once.
+*/
+#ifdef CPU_ENGINE_SSE
+
+typedef __m128 Vec4;
+
+static inline Vec4 vec4Set(float r, float g, float b, float a) { return _mm_setr_ps(r, g, b, a); }
+static inline Vec4 vec4Splat(float value) { return _mm_set1_ps(value); }
+static inline Vec4 vec4Load(const float* p) { return _mm_loadu_ps(p); }
+static inline void vec4Store(float* p, Vec4 v) { _mm_storeu_ps(p, v); }
+static inline Vec4 vec4Add(Vec4 a, Vec4 b) { return _mm_add_ps(a, b); }
+static inline Vec4 vec4Mul(Vec4 a, Vec4 b) { return _mm_mul_ps(a, b); }
+static inline Vec4 vec4Clamp(Vec4 v, float low, float high) { return _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(low)), _mm_set1_ps(high)); }
+
+// (average, average, average, alpha) like the gray scale in saturate()
+static inline Vec4 vec4Gray(Vec4 v) {
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_shuffle_ps(v, v, 0x00), _mm_shuffle_ps(v, v, 0x55)), _mm_shuffle_ps(v, v, 0xaa));
+    __m128 average = _mm_div_ps(sum, _mm_set1_ps(3.0f));
+    __m128 alphaMask = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+    return _mm_or_ps(_mm_andnot_ps(alphaMask, average), _mm_and_ps(alphaMask, v));
+}
+
+// rounds to the nearest integer and packs to 4 bytes, like packUnorm4x8(value / 255.0)
+static inline void vec4StoreBytes(unsigned char* p, Vec4 v) {
+    __m128i integers = _mm_cvtps_epi32(v);
+    __m128i shorts = _mm_packs_epi32(integers, integers);
+    __m128i bytes = _mm_packus_epi16(shorts, shorts);
+    int packed = _mm_cvtsi128_si32(bytes);
+    memcpy(p, &packed, 4);
+}
+
+#else
+
+struct Vec4 {
+    float v[4];
+};
+
+static inline Vec4 vec4Set(float r, float g, float b, float a) { Vec4 result = { { r, g, b, a } }; return result; }
+static inline Vec4 vec4Splat(float value) { return vec4Set(value, value, value, value); }
+static inline Vec4 vec4Load(const float* p) { return vec4Set(p[0], p[1], p[2], p[3]); }
+static inline void vec4Store(float* p, Vec4 v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline Vec4 vec4Add(Vec4 a, Vec4 b) { return vec4Set(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]); }
+static inline Vec4 vec4Mul(Vec4 a, Vec4 b) { return vec4Set(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]); }
+
+static inline Vec4 vec4Clamp(Vec4 v, float low, float high) {
+    for (int i = 0; i < 4; ++i) {
+        v.v[i] = min(max(v.v[i], low), high);
+    }
+    return v;
+}
+
+static inline Vec4 vec4Gray(Vec4 v) {
+    float average = (v.v[0] + v.v[1] + v.v[2]) / 3.0f;
+    return vec4Set(average, average, average, v.v[3]);
+}
+
+static inline void vec4StoreBytes(unsigned char* p, Vec4 v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = (unsigned char)lrintf(v.v[i]);
+    }
+}
+
+#endif
+
+CpuEngine::CpuEngine(size_t threadCount) : pool(threadCount) {
+}
+
+Image CpuEngine::process(const Image& input, const FilterParams& params) {
+
+    uint32_t width = input.width;
+    uint32_t height = input.height;
+
+    //the same normalized table the GPU reads from its weight buffer
+    std::vector<float> weights = ComputeApplication::computeGaussWeights(params.blur);
+    int32_t n = (int32_t)weights.size();
+    int32_t radius = n / 2;
+
+    //result of the horizontal pass, 4 floats per pixel like the intermediate buffer
+    std::vector<float> intermediate((size_t)width * height * 4);
+
+    Image output;
+    output.width = width;
+    output.height = height;
+    output.pixels.resize((size_t)width * height * 4);
+
+    //horizontal pass, like blurHorizontal.comp
+    pool.parallelFor(height, [&](size_t begin, size_t end) {
+
+        //the row converted to floats and extended by the radius on both sides, wrapped
+        //around like GetPixelWrapped(), so the inner loop needs no bounds checks
+        std::vector<float> row(((size_t)width + 2 * radius) * 4);
+
+        for (size_t y = begin; y < end; ++y) {
+            const unsigned char* source = input.data() + y * width * 4;
+            for (int32_t x = -radius; x < (int32_t)width + radius; ++x) {
+                int32_t wrapped = x % (int32_t)width;
+                if (wrapped < 0) {
+                    wrapped += width;
+                }
+                for (int c = 0; c < 4; ++c) {
+                    row[(size_t)(x + radius) * 4 + c] = (float)source[wrapped * 4 + c];
+                }
+            }
+
+            float* destination = &intermediate[y * width * 4];
+            for (uint32_t x = 0; x < width; ++x) {
+                Vec4 sum = vec4Splat(0.0f);
+                const float* window = &row[(size_t)x * 4];
+                for (int32_t i = 0; i < n; ++i) {
+                    sum = vec4Add(sum, vec4Mul(vec4Splat(weights[i]), vec4Load(window + i * 4)));
+                }
+                vec4Store(destination + (size_t)x * 4, sum);
+            }
+        }
+    });
+
+    //vertical pass and finalColor(), like blurVertical.comp
+    Vec4 tint = vec4Set(params.color[0], params.color[1], params.color[2], params.color[3]);
+    Vec4 saturation = vec4Splat(params.saturation);
+    Vec4 oneMinusSaturation = vec4Splat(1.0f - params.saturation);
+
+    pool.parallelFor(height, [&](size_t begin, size_t end) {
+
+        //whole rows are accumulated at a time, which reads the intermediate image row by row
+        std::vector<float> sums((size_t)width * 4);
+
+        for (size_t y = begin; y < end; ++y) {
+            std::fill(sums.begin(), sums.end(), 0.0f);
+
+            for (int32_t i = 0; i < n; ++i) {
+                int32_t sourceY = ((int32_t)y - radius + i) % (int32_t)height;
+                if (sourceY < 0) {
+                    sourceY += height;
+                }
+                const float* source = &intermediate[(size_t)sourceY * width * 4];
+                Vec4 weight = vec4Splat(weights[i]);
+                for (uint32_t x = 0; x < width; ++x) {
+                    float* sum = &sums[(size_t)x * 4];
+                    vec4Store(sum, vec4Add(vec4Load(sum), vec4Mul(weight, vec4Load(source + (size_t)x * 4))));
+                }
+            }
+
+            unsigned char* destination = &output.pixels[y * width * 4];
+            for (uint32_t x = 0; x < width; ++x) {
+                Vec4 tinted = vec4Mul(tint, vec4Load(&sums[(size_t)x * 4]));
+                Vec4 saturated = vec4Add(vec4Mul(oneMinusSaturation, vec4Gray(tinted)), vec4Mul(saturation, tinted));
+                vec4StoreBytes(destination + (size_t)x * 4, vec4Clamp(saturated, 0.0f, 255.0f));
+            }
+        }
+    });
+
+    return output;
+}
+
+ImageDifference CpuEngine::compare(const Image& first, const Image& second, int tolerance) {
+
+    if (first.width != second.width || first.height != second.height) {
+        throw std::runtime_error("can not compare images of different size");
+    }
+
+    ImageDifference difference;
+    size_t pixelCount = (size_t)first.width * first.height;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        int pixelDifference = 0;
+        for (int c = 0; c < 4; ++c) {
+            pixelDifference = max(pixelDifference, abs((int)first.pixels[i * 4 + c] - (int)second.pixels[i * 4 + c]));
+        }
+        difference.maxDifference = max(difference.maxDifference, pixelDifference);
+        if (pixelDifference > tolerance) {
+            ++difference.differingPixels;
+        }
+    }
+    return difference;
+}
@@ -0,0 +1,229 @@
+#include "../include/FilterGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+
+bool FilterOp::isPointOp() const {
+    return type == FILTER_OP_TINT || type == FILTER_OP_SATURATION || type == FILTER_OP_BRIGHTNESS_CONTRAST || type == FILTER_OP_LUT;
+}
+
+FilterGraph& FilterGraph::blur(int32_t size) {
+
+    //odd and at least 3, like the window of the fixed kernels
+    FilterOp op;
+    op.type = FILTER_OP_BLUR;
+    op.size = std::max(size, 3);
+    if (op.size % 2 == 0) {
+        op.size += 1;
+    }
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph& FilterGraph::tint(float r, float g, float b, float a) {
+    FilterOp op;
+    op.type = FILTER_OP_TINT;
+    op.values[0] = r;
+    op.values[1] = g;
+    op.values[2] = b;
+    op.values[3] = a;
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph& FilterGraph::saturation(float amount) {
+    FilterOp op;
+    op.type = FILTER_OP_SATURATION;
+    op.values[0] = amount;
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph& FilterGraph::brightnessContrast(float brightness, float contrast) {
+    FilterOp op;
+    op.type = FILTER_OP_BRIGHTNESS_CONTRAST;
+    op.values[0] = brightness;
+    op.values[1] = contrast;
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph& FilterGraph::lut(const std::vector<float>& table) {
+
+    if (table.size() != 256 * 4) {
+        throw std::runtime_error("FilterGraph::lut: the table needs 256 RGBA entries");
+    }
+    FilterOp op;
+    op.type = FILTER_OP_LUT;
+    op.lut = table;
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph& FilterGraph::gamma(float gamma) {
+
+    //alpha stays as it is
+    std::vector<float> table(256 * 4);
+    for (int i = 0; i < 256; ++i) {
+        float value = 255.0f * powf(i / 255.0f, 1.0f / gamma);
+        table[i * 4 + 0] = value;
+        table[i * 4 + 1] = value;
+        table[i * 4 + 2] = value;
+        table[i * 4 + 3] = (float)i;
+    }
+    return lut(table);
+}
+
+FilterGraph& FilterGraph::resize(uint32_t width, uint32_t height) {
+
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("FilterGraph::resize: the size must not be 0");
+    }
+    FilterOp op;
+    op.type = FILTER_OP_RESIZE;
+    op.width = width;
+    op.height = height;
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph& FilterGraph::sharpen(float amount) {
+    FilterOp op;
+    op.type = FILTER_OP_SHARPEN;
+    op.values[0] = amount;
+    ops.push_back(op);
+    return *this;
+}
+
+FilterGraph FilterGraph::parse(const std::string& description) {
+
+    FilterGraph graph;
+    std::stringstream stream(description);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        size_t equals = item.find('=');
+        std::string name = item.substr(0, equals);
+        std::string arguments = equals == std::string::npos ? "" : item.substr(equals + 1);
+
+        //values are separated by colons, resize takes WxH
+        std::vector<float> values;
+        std::stringstream argumentStream(arguments);
+        std::string value;
+        while (std::getline(argumentStream, value, name == "resize" ? 'x' : ':')) {
+            char* end = NULL;
+            values.push_back(strtof(value.c_str(), &end));
+            if (value.empty() || *end != '\0') {
+                throw std::runtime_error("FilterGraph::parse: bad value '" + value + "' in " + item);
+            }
+        }
+
+        if (name == "blur" && values.size() == 1) {
+            graph.blur((int32_t)values[0]);
+        }
+        else if (name == "tint" && values.size() == 4) {
+            graph.tint(values[0], values[1], values[2], values[3]);
+        }
+        else if (name == "saturation" && values.size() == 1) {
+            graph.saturation(values[0]);
+        }
+        else if (name == "brightness" && (values.size() == 1 || values.size() == 2)) {
+            graph.brightnessContrast(values[0], values.size() == 2 ? values[1] : 1.0f);
+        }
+        else if (name == "gamma" && values.size() == 1 && values[0] > 0.0f) {
+            graph.gamma(values[0]);
+        }
+        else if (name == "resize" && values.size() == 2 && values[0] >= 1.0f && values[1] >= 1.0f) {
+            graph.resize((uint32_t)values[0], (uint32_t)values[1]);
+        }
+        else if (name == "sharpen" && values.size() == 1) {
+            graph.sharpen(values[0]);
+        }
+        else {
+            throw std::runtime_error("FilterGraph::parse: unknown filter " + item);
+        }
+    }
+    return graph;
+}
+
+const std::vector<FilterOp>& FilterGraph::operations() const {
+    return ops;
+}
+
+std::vector<FilterPass> FilterGraph::compile(uint32_t width, uint32_t height) const {
+
+    std::vector<FilterPass> passes;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const FilterOp& op = ops[i];
+
+        //fused into whatever pass comes before
+        if (op.isPointOp()) {
+            if (passes.empty()) {
+                FilterPass pass;
+                pass.width = width;
+                pass.height = height;
+                passes.push_back(pass);
+            }
+            passes.back().pointOps.push_back(i);
+            continue;
+        }
+
+        FilterPass pass;
+        pass.width = width;
+        pass.height = height;
+        if (op.type == FILTER_OP_BLUR) {
+            pass.stencil = FILTER_STENCIL_BLUR_HORIZONTAL;
+            pass.blurSize = op.size;
+            passes.push_back(pass);
+            pass.stencil = FILTER_STENCIL_BLUR_VERTICAL;
+        }
+        else if (op.type == FILTER_OP_SHARPEN) {
+            pass.stencil = FILTER_STENCIL_SHARPEN;
+            pass.amount = op.values[0];
+        }
+        else {
+            pass.stencil = FILTER_STENCIL_RESIZE;
+            width = pass.width = op.width;
+            height = pass.height = op.height;
+        }
+        passes.push_back(pass);
+    }
+
+    //an empty graph still has to write the output
+    if (passes.empty()) {
+        FilterPass pass;
+        pass.width = width;
+        pass.height = height;
+        passes.push_back(pass);
+    }
+    return passes;
+}
+
+int32_t FilterGraph::reach() const {
+
+    int32_t pixels = 0;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (ops[i].type == FILTER_OP_BLUR) {
+            pixels += ops[i].size / 2;
+        }
+        else if (ops[i].type == FILTER_OP_SHARPEN) {
+            pixels += 1;
+        }
+    }
+    return pixels;
+}
+
+bool FilterGraph::resizes() const {
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (ops[i].type == FILTER_OP_RESIZE) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,460 @@
+#include "../include/JobServer.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+std::string ServerStats::toJson() const {
+
+    std::ostringstream json;
+    json << "{\"accepted\": " << accepted
+        << ", \"completed\": " << completed
+        << ", \"failed\": " << failed
+        << ", \"batches\": " << batches
+        << ", \"queue_depth\": " << queueDepth
+        << ", \"max_queue_depth\": " << maxQueueDepth
+        << ", \"uptime_s\": " << uptime
+        << ", \"busy_s\": " << busyTime
+        << ", \"jobs_per_s\": " << (uptime > 0.0 ? completed / uptime : 0.0)
+        << ", \"latency_ms_histogram\": [";
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        json << (i == 0 ? "" : ", ") << latency[i];
+    }
+    json << "]}";
+    return json.str();
+}
+
+// Jobs with the same settings can share a processBatch() call.
+static bool sameParams(const FilterParams& first, const FilterParams& second) {
+    return memcmp(first.color, second.color, sizeof(first.color)) == 0 && first.saturation == second.saturation &&
+        first.blur == second.blur && first.blurMode == second.blurMode && first.graph == second.graph;
+}
+
+// Tabs separate the fields if there are any, otherwise spaces.
+static std::vector<std::string> splitFields(const std::string& line) {
+
+    char separator = line.find('\t') != std::string::npos ? '\t' : ' ';
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, separator)) {
+        if (!field.empty()) {
+            fields.push_back(field);
+        }
+    }
+    return fields;
+}
+
+// The whole value has to be a number, atoi() and atof() would take "abc" for 0.
+static int32_t parseInteger(const std::string& key, const std::string& value) {
+
+    char* end = NULL;
+    long number = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || number < INT32_MIN || number > INT32_MAX) {
+        throw std::runtime_error(key + " needs an integer, not '" + value + "'");
+    }
+    return (int32_t)number;
+}
+
+static float parseFloat(const std::string& key, const std::string& value) {
+
+    char* end = NULL;
+    double number = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || !std::isfinite(number)) {
+        throw std::runtime_error(key + " needs a number, not '" + value + "'");
+    }
+    return (float)number;
+}
+
+static void checkBlur(int32_t blur) {
+    if (blur < 1 || blur > MAX_JOB_BLUR) {
+        throw std::runtime_error("blur must be 1 to " + std::to_string(MAX_JOB_BLUR) + ", not " + std::to_string(blur));
+    }
+}
+
+JobServer::JobServer(ComputeApplication& app, const FilterParams& defaults, size_t queueCapacity, size_t maxBatch)
+    : app(app), defaults(defaults), maxBatch(max(maxBatch, (size_t)1)), queue(max(queueCapacity, (size_t)1)), stopping(false) {
+}
+
+std::shared_ptr<JobServer::Job> JobServer::parseJob(const std::vector<std::string>& fields) {
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->params = defaults;
+    for (size_t i = 1; i < fields.size(); ++i) {
+        size_t equals = fields[i].find('=');
+        std::string key = fields[i].substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : fields[i].substr(equals + 1);
+
+        if (key == "input") {
+            job->files.input = value;
+        }
+        else if (key == "output") {
+            job->files.output = value;
+        }
+        else if (key == "blur") {
+            job->params.blur = parseInteger(key, value);
+            checkBlur(job->params.blur);
+        }
+        else if (key == "saturation") {
+            job->params.saturation = parseFloat(key, value);
+        }
+        else if (key == "tint") {
+            std::stringstream stream(value);
+            std::string component;
+            int count = 0;
+            while (std::getline(stream, component, ':')) {
+                if (count == 4) {
+                    throw std::runtime_error("tint needs R:G:B:A");
+                }
+                job->params.color[count++] = parseFloat(key, component);
+            }
+            if (count != 4) {
+                throw std::runtime_error("tint needs R:G:B:A");
+            }
+        }
+        else if (key == "graph") {
+            //the same description always gets the same graph, while it is one of the last used ones
+            std::lock_guard<std::mutex> lock(graphMutex);
+            std::map<std::string, CachedGraph>::iterator found = graphs.find(value);
+            if (found == graphs.end()) {
+                CachedGraph cached;
+                cached.graph = std::make_shared<FilterGraph>(FilterGraph::parse(value));
+                checkGraph(*cached.graph);
+
+                //queued jobs keep their graph, only sharing it with later jobs ends
+                if (graphs.size() >= MAX_CACHED_GRAPHS) {
+                    std::map<std::string, CachedGraph>::iterator oldest = graphs.begin();
+                    for (std::map<std::string, CachedGraph>::iterator it = graphs.begin(); it != graphs.end(); ++it) {
+                        if (it->second.lastUse < oldest->second.lastUse) {
+                            oldest = it;
+                        }
+                    }
+                    graphs.erase(oldest);
+                }
+                found = graphs.insert(std::make_pair(value, cached)).first;
+            }
+            found->second.lastUse = ++graphUses;
+            job->params.graph = found->second.graph;
+        }
+        else {
+            throw std::runtime_error("unknown field " + fields[i]);
+        }
+    }
+    if (job->files.input.empty() || job->files.output.empty()) {
+        throw std::runtime_error("process needs input= and output=");
+    }
+    return job;
+}
+
+void JobServer::checkGraph(const FilterGraph& graph) const {
+
+    const std::vector<FilterOp>& ops = graph.operations();
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (ops[i].type == FILTER_OP_BLUR) {
+            checkBlur(ops[i].size);
+        }
+        //the passes of a resizing graph can not be split into tiles, the whole result has to fit
+        if (ops[i].type == FILTER_OP_RESIZE && (uint64_t)ops[i].width * ops[i].height > app.maxImagePixels()) {
+            throw std::runtime_error("resize to " + std::to_string(ops[i].width) + "x" + std::to_string(ops[i].height) +
+                " is larger than the device buffers hold");
+        }
+    }
+}
+
+std::string JobServer::handleRequest(const std::string& line) {
+
+    std::vector<std::string> fields = splitFields(line);
+    if (fields.empty()) {
+        return "error empty request";
+    }
+
+    if (fields[0] == "stats") {
+        return stats().toJson();
+    }
+
+    if (fields[0] == "quit") {
+        stopping = true;
+#ifndef _WIN32
+        //wakes up accept() in run()
+        shutdown(listenSocket, SHUT_RDWR);
+#endif
+        return "ok";
+    }
+
+    if (fields[0] != "process") {
+        return "error unknown command " + fields[0];
+    }
+
+    std::shared_ptr<Job> job;
+    try {
+        job = parseJob(fields);
+    }
+    catch (const std::exception& e) {
+        return std::string("error ") + e.what();
+    }
+    job->arrival = std::chrono::high_resolution_clock::now();
+    std::future<std::string> reply = job->reply.get_future();
+
+    //blocks while the queue is full, which keeps this connection from reading more
+    queue.push(job);
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        ++counters.accepted;
+        counters.maxQueueDepth = max(counters.maxQueueDepth, queue.size());
+    }
+    return reply.get();
+}
+
+void JobServer::finishJob(Job& job, const std::string& error) {
+
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - job.arrival).count();
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency >= (double)(1 << bucket)) {
+        ++bucket;
+    }
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        ++counters.latency[bucket];
+        ++(error.empty() ? counters.completed : counters.failed);
+    }
+
+    if (error.empty()) {
+        job.reply.set_value("ok " + std::to_string(latency));
+        return;
+    }
+
+    //the reply is a single line
+    std::string message = error;
+    for (size_t i = 0; i < message.size(); ++i) {
+        if (message[i] == '\n' || message[i] == '\r') {
+            message[i] = ' ';
+        }
+    }
+    job.reply.set_value("error " + message);
+}
+
+void JobServer::runBatch(const std::vector<std::shared_ptr<Job>>& jobs) {
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<BatchJob> files;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        files.push_back(jobs[i]->files);
+    }
+
+    std::string error;
+    try {
+        app.processBatch(files, jobs[0]->params);
+    }
+    catch (const std::exception& e) {
+        error = e.what();
+    }
+
+    //a failed batch does not tell which image failed, so its jobs run again one at a time
+    if (!error.empty() && jobs.size() > 1) {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            std::string jobError;
+            try {
+                app.processFile(jobs[i]->files, jobs[i]->params);
+            }
+            catch (const std::exception& e) {
+                jobError = e.what();
+            }
+            finishJob(*jobs[i], jobError);
+        }
+    }
+    else {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            finishJob(*jobs[i], error);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ++counters.batches;
+    counters.busyTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void JobServer::worker() {
+
+    std::shared_ptr<Job> first;
+    while (queue.pop(first)) {
+
+        //take what else is waiting, up to a batch
+        std::vector<std::shared_ptr<Job>> waiting(1, first);
+        std::shared_ptr<Job> next;
+        while (waiting.size() < maxBatch && queue.tryPop(next)) {
+            waiting.push_back(next);
+        }
+
+        //one batch per setting, in the order the jobs came in
+        while (!waiting.empty()) {
+            std::vector<std::shared_ptr<Job>> batch;
+            std::vector<std::shared_ptr<Job>> rest;
+            for (size_t i = 0; i < waiting.size(); ++i) {
+                (sameParams(waiting[i]->params, waiting[0]->params) ? batch : rest).push_back(waiting[i]);
+            }
+            runBatch(batch);
+            waiting.swap(rest);
+        }
+    }
+}
+
+void JobServer::serveConnection(int connection) {
+
+#ifndef _WIN32
+    std::string buffered;
+    char chunk[4096];
+    while (true) {
+        size_t newline = buffered.find('\n');
+        if (newline == std::string::npos) {
+            ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+            if (received <= 0) {
+                break;
+            }
+            buffered.append(chunk, (size_t)received);
+            continue;
+        }
+
+        std::string line = buffered.substr(0, newline);
+        buffered.erase(0, newline + 1);
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+
+        std::string reply = handleRequest(line) + "\n";
+        if (send(connection, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size()) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(connectionMutex);
+    connections.erase(std::find(connections.begin(), connections.end(), connection));
+    close(connection);
+    connectionsClosed.notify_all();
+#endif
+}
+
+void JobServer::run(const std::string& socketPath) {
+
+#ifdef _WIN32
+    throw std::runtime_error("JobServer::run: the job server needs Unix domain sockets");
+#else
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("JobServer::run: socket path " + socketPath + " is too long");
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    //a socket file left behind by a server that did not shut down
+    unlink(socketPath.c_str());
+
+    listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0 || bind(listenSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenSocket, 16) != 0) {
+        if (listenSocket >= 0) {
+            close(listenSocket);
+        }
+        throw std::runtime_error("JobServer::run: can not listen on " + socketPath);
+    }
+    cout << "job server listening on " << socketPath << endl;
+
+    startTime = std::chrono::high_resolution_clock::now();
+    std::thread workerThread(&JobServer::worker, this);
+
+    //one thread per connection, each waits for the replies to its jobs
+    while (!stopping) {
+        int connection = accept(listenSocket, NULL, NULL);
+        if (connection < 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        connections.push_back(connection);
+        std::thread(&JobServer::serveConnection, this, connection).detach();
+    }
+
+    //no new requests, the queued jobs still get their replies
+    {
+        std::unique_lock<std::mutex> lock(connectionMutex);
+        for (size_t i = 0; i < connections.size(); ++i) {
+            shutdown(connections[i], SHUT_RD);
+        }
+        connectionsClosed.wait(lock, [this]() { return connections.empty(); });
+    }
+    queue.close();
+    workerThread.join();
+
+    close(listenSocket);
+    listenSocket = -1;
+    unlink(socketPath.c_str());
+#endif
+}
+
+ServerStats JobServer::stats() {
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ServerStats current = counters;
+    current.queueDepth = queue.size();
+    current.uptime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    return current;
+}
+
+JobClient::JobClient(const std::string& socketPath) {
+
+#ifdef _WIN32
+    throw std::runtime_error("JobClient: the job server needs Unix domain sockets");
+#else
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("JobClient: socket path " + socketPath + " is too long");
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (sockaddr*)&address, sizeof(address)) != 0) {
+        if (connection >= 0) {
+            close(connection);
+        }
+        throw std::runtime_error("JobClient: can not connect to " + socketPath);
+    }
+#endif
+}
+
+JobClient::~JobClient() {
+#ifndef _WIN32
+    close(connection);
+#endif
+}
+
+std::string JobClient::request(const std::string& line) {
+
+#ifdef _WIN32
+    return "error no Unix domain sockets";
+#else
+    std::string message = line + "\n";
+    if (send(connection, message.data(), message.size(), MSG_NOSIGNAL) != (ssize_t)message.size()) {
+        throw std::runtime_error("JobClient::request: the server closed the connection");
+    }
+
+    char chunk[4096];
+    size_t newline;
+    while ((newline = buffered.find('\n')) == std::string::npos) {
+        ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            throw std::runtime_error("JobClient::request: the server closed the connection");
+        }
+        buffered.append(chunk, (size_t)received);
+    }
+    std::string reply = buffered.substr(0, newline);
+    buffered.erase(0, newline + 1);
+    return reply;
+#endif
+}
@@ -0,0 +1,230 @@
+#include "../include/MemoryAllocator.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize) {
+
+    this->physicalDevice = physicalDevice;
+    this->device = device;
+    this->blockSize = blockSize;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+void MemoryAllocator::cleanup() {
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        destroyBlock(blocks[i]);
+    }
+    blocks.clear();
+}
+
+const VkPhysicalDeviceMemoryProperties& MemoryAllocator::getMemoryProperties() const {
+    return memoryProperties;
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const {
+
+    /*
+    How does this search work?
+    See the documentation of VkPhysicalDeviceMemoryProperties for a detailed description.
+    */
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        //if this memory type's index is set inside memoryTypeBits and it has all the specified properties
+        if ((memoryTypeBits & (1 << i)) &&
+            ((memoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
+            return i;
+    }
+    return -1;
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+    VkMemoryPropertyFlags preferredProperties) {
+
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties | preferredProperties);
+    if (memoryType == (uint32_t)-1) {
+        memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+    }
+    if (memoryType == (uint32_t)-1) {
+        throw std::runtime_error("MemoryAllocator::allocate: no memory type with the required properties");
+    }
+
+    //first fit in the blocks of this memory type
+    Allocation allocation;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].memory != VK_NULL_HANDLE && blocks[i].memoryType == memoryType &&
+            allocateFromBlock(blocks[i], requirements.size, requirements.alignment, allocation)) {
+            allocation.block = i;
+            return allocation;
+        }
+    }
+
+    //Small heaps, like the 256MB host visible window of a discrete GPU, get smaller blocks.
+    //Anything larger than a block gets a block of its own.
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize newBlockSize = std::max(std::min(blockSize, heapSize / 4), requirements.size);
+    size_t block = createBlock(memoryType, newBlockSize);
+    if (block == (size_t)-1 && newBlockSize > requirements.size) {
+        block = createBlock(memoryType, requirements.size);
+    }
+    if (block == (size_t)-1) {
+        throw std::runtime_error("MemoryAllocator::allocate: out of device memory for " + std::to_string(requirements.size) + " bytes");
+    }
+
+    allocateFromBlock(blocks[block], requirements.size, requirements.alignment, allocation);
+    allocation.block = block;
+    return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation) {
+
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    Block& block = blocks[allocation.block];
+    block.allocations -= 1;
+
+    //merge with the free ranges right before and after, so they can hold a larger buffer again
+    VkDeviceSize offset = allocation.offset;
+    VkDeviceSize size = allocation.size;
+    std::map<VkDeviceSize, VkDeviceSize>::iterator next = block.freeRanges.lower_bound(offset);
+    if (next != block.freeRanges.end() && offset + size == next->first) {
+        size += next->second;
+        next = block.freeRanges.erase(next);
+    }
+    if (next != block.freeRanges.begin()) {
+        std::map<VkDeviceSize, VkDeviceSize>::iterator previous = next;
+        --previous;
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            block.freeRanges.erase(previous);
+        }
+    }
+    block.freeRanges[offset] = size;
+
+    if (block.dedicated && block.allocations == 0) {
+        destroyBlock(block);
+    }
+    allocation = Allocation();
+}
+
+bool MemoryAllocator::allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation) {
+
+    for (std::map<VkDeviceSize, VkDeviceSize>::iterator it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        VkDeviceSize rangeStart = it->first;
+        VkDeviceSize rangeEnd = it->first + it->second;
+        VkDeviceSize offset = (rangeStart + alignment - 1) / alignment * alignment;
+        if (offset + size > rangeEnd) {
+            continue;
+        }
+
+        //the alignment padding and the rest of the range stay free
+        block.freeRanges.erase(it);
+        if (offset > rangeStart) {
+            block.freeRanges[rangeStart] = offset - rangeStart;
+        }
+        if (offset + size < rangeEnd) {
+            block.freeRanges[offset + size] = rangeEnd - offset - size;
+        }
+
+        block.allocations += 1;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.mapped = block.mapped == NULL ? NULL : (char*)block.mapped + offset;
+        return true;
+    }
+    return false;
+}
+
+size_t MemoryAllocator::createBlock(uint32_t memoryType, VkDeviceSize size) {
+
+    Block block;
+    block.size = size;
+    block.memoryType = memoryType;
+    block.dedicated = size > blockSize;
+    block.mapped = NULL;
+    block.allocations = 0;
+    block.freeRanges[0] = size;
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = size;
+    allocateInfo.memoryTypeIndex = memoryType;
+    if (vkAllocateMemory(device, &allocateInfo, NULL, &block.memory) != VK_SUCCESS) {
+        return -1;
+    }
+
+    //mapped for as long as the block lives, every buffer in it uses this one mapping
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS) {
+            vkFreeMemory(device, block.memory, NULL);
+            return -1;
+        }
+    }
+
+    //reuse the slot of a freed block
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].memory == VK_NULL_HANDLE) {
+            blocks[i] = block;
+            return i;
+        }
+    }
+    blocks.push_back(block);
+    return blocks.size() - 1;
+}
+
+void MemoryAllocator::destroyBlock(Block& block) {
+
+    if (block.memory == VK_NULL_HANDLE) {
+        return;
+    }
+    if (block.mapped != NULL) {
+        vkUnmapMemory(device, block.memory);
+    }
+    vkFreeMemory(device, block.memory, NULL);
+    block.memory = VK_NULL_HANDLE;
+    block.mapped = NULL;
+    block.freeRanges.clear();
+}
+
+MemoryStats MemoryAllocator::getStats() const {
+
+    MemoryStats stats;
+    VkDeviceSize freeBytes = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const Block& block = blocks[i];
+        if (block.memory == VK_NULL_HANDLE) {
+            continue;
+        }
+        stats.blocks += 1;
+        stats.allocations += block.allocations;
+        stats.reservedBytes += block.size;
+        stats.freeRanges += block.freeRanges.size();
+        for (std::map<VkDeviceSize, VkDeviceSize>::const_iterator it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+            freeBytes += it->second;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, it->second);
+        }
+    }
+    stats.usedBytes = stats.reservedBytes - freeBytes;
+    return stats;
+}
+
+double MemoryStats::fragmentation() const {
+
+    VkDeviceSize freeBytes = reservedBytes - usedBytes;
+    return freeBytes == 0 ? 0.0 : 1.0 - (double)largestFreeRange / freeBytes;
+}
+
+void MemoryStats::print() const {
+
+    const double megabyte = 1024.0 * 1024.0;
+    std::cout << "device memory: " << blocks << " blocks, " << reservedBytes / megabyte << " MB reserved, "
+        << usedBytes / megabyte << " MB used by " << allocations << " buffers, "
+        << freeRanges << " free ranges, " << fragmentation() * 100.0 << "% fragmented" << std::endl;
+}
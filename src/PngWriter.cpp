@@ -0,0 +1,404 @@
+#include "../include/PngWriter.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+
+//Deflate length and distance codes, RFC 1951 section 3.2.5.
+static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+    2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static const int WINDOW_SIZE = 32768;
+static const int HASH_BITS = 15;
+static const int MIN_MATCH = 3;
+static const int MAX_MATCH = 258;
+
+//Appends bits least significant first, the order deflate reads them in.
+struct BitWriter {
+    std::vector<unsigned char>& out;
+    uint32_t buffer = 0;
+    int count = 0;
+
+    explicit BitWriter(std::vector<unsigned char>& out) : out(out) {}
+
+    void add(uint32_t bits, int length) {
+        buffer |= bits << count;
+        count += length;
+        while (count >= 8) {
+            out.push_back((unsigned char)buffer);
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    //Huffman codes are defined most significant bit first
+    void addCode(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        add(reversed, length);
+    }
+
+    void alignToByte() {
+        if (count > 0) {
+            add(0, 8 - count);
+        }
+    }
+};
+
+// Fixed Huffman code of a literal or length symbol.
+static void writeSymbol(BitWriter& bits, int symbol) {
+    if (symbol < 144) bits.addCode(0x30 + symbol, 8);
+    else if (symbol < 256) bits.addCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) bits.addCode(symbol - 256, 7);
+    else bits.addCode(0xc0 + symbol - 280, 8);
+}
+
+static void writeMatch(BitWriter& bits, int length, int distance) {
+
+    int lengthCode = 28;
+    while (lengthBase[lengthCode] > length) {
+        --lengthCode;
+    }
+    writeSymbol(bits, 257 + lengthCode);
+    bits.add(length - lengthBase[lengthCode], lengthExtra[lengthCode]);
+
+    int distanceCode = 29;
+    while (distanceBase[distanceCode] > distance) {
+        --distanceCode;
+    }
+    bits.addCode(distanceCode, 5);
+    bits.add(distance - distanceBase[distanceCode], distanceExtra[distanceCode]);
+}
+
+static inline uint32_t hash3(const unsigned char* p) {
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/*
+Deflates data[begin, end) as one fixed Huffman block. Matches may reach back into the 32KB before
+begin, the decoder already has those bytes from the previous band. Unless this is the last band,
+the block ends with a sync flush so the next band starts on a byte boundary.
+*/
+static void deflateBand(const unsigned char* data, size_t begin, size_t end, int level, bool last, std::vector<unsigned char>& out) {
+
+    BitWriter bits(out);
+
+    if (level == PNG_STORE) {
+        //stored blocks of at most 65535 bytes, always byte aligned
+        size_t position = begin;
+        do {
+            size_t length = std::min(end - position, (size_t)65535);
+            bool final = last && position + length == end;
+            bits.add(final ? 1 : 0, 1);
+            bits.add(0, 2);
+            bits.alignToByte();
+            out.push_back((unsigned char)length);
+            out.push_back((unsigned char)(length >> 8));
+            out.push_back((unsigned char)~length);
+            out.push_back((unsigned char)(~length >> 8));
+            out.insert(out.end(), data + position, data + position + length);
+            position += length;
+        } while (position < end);
+        return;
+    }
+
+    //longer chains find longer matches, and a match of niceLength ends the search
+    static const int chainLengths[10] = { 0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+    static const int niceLengths[10] = { 0, 8, 16, 32, 64, 128, 128, 258, 258, 258 };
+    int maxChain = chainLengths[level];
+    int niceLength = niceLengths[level];
+
+    std::vector<int64_t> head((size_t)1 << HASH_BITS, -1);
+    std::vector<int64_t> previous(WINDOW_SIZE, -1);
+    auto insert = [&](size_t position) {
+        uint32_t h = hash3(data + position);
+        previous[position % WINDOW_SIZE] = head[h];
+        head[h] = (int64_t)position;
+    };
+
+    //the window before the band
+    size_t windowStart = begin > (size_t)WINDOW_SIZE ? begin - WINDOW_SIZE : 0;
+    for (size_t position = windowStart; position + MIN_MATCH <= begin; ++position) {
+        insert(position);
+    }
+
+    bits.add(last ? 1 : 0, 1);
+    bits.add(1, 2);     //fixed Huffman codes
+
+    size_t position = begin;
+    while (position < end) {
+        int bestLength = 0;
+        size_t bestDistance = 0;
+
+        if (position + MIN_MATCH <= end) {
+            int maxLength = (int)std::min(end - position, (size_t)MAX_MATCH);
+            int64_t candidate = head[hash3(data + position)];
+            for (int chain = 0; chain < maxChain && candidate >= 0; ++chain) {
+                size_t distance = position - (size_t)candidate;
+                if (distance > (size_t)WINDOW_SIZE) {
+                    break;
+                }
+                const unsigned char* a = data + candidate;
+                const unsigned char* b = data + position;
+                int length = 0;
+                while (length < maxLength && a[length] == b[length]) {
+                    ++length;
+                }
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = distance;
+                    if (length >= niceLength) {
+                        break;
+                    }
+                }
+                int64_t next = previous[(size_t)candidate % WINDOW_SIZE];
+                if (next >= candidate) {
+                    break;      //overwritten by a newer position
+                }
+                candidate = next;
+            }
+        }
+
+        if (bestLength >= MIN_MATCH) {
+            writeMatch(bits, bestLength, (int)bestDistance);
+            for (int i = 0; i < bestLength; ++i, ++position) {
+                if (position + MIN_MATCH <= end) {
+                    insert(position);
+                }
+            }
+        }
+        else {
+            writeSymbol(bits, data[position]);
+            if (position + MIN_MATCH <= end) {
+                insert(position);
+            }
+            ++position;
+        }
+    }
+    writeSymbol(bits, 256);
+
+    if (last) {
+        bits.alignToByte();
+    }
+    else {
+        //empty stored block: 3 header bits, byte align, LEN 0 and NLEN 0xffff
+        bits.add(0, 3);
+        bits.alignToByte();
+        out.push_back(0x00);
+        out.push_back(0x00);
+        out.push_back(0xff);
+        out.push_back(0xff);
+    }
+}
+
+static uint32_t adler32(const unsigned char* data, size_t length) {
+
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (length > 0) {
+        //5552 bytes is the most that can be summed before b overflows
+        size_t chunk = std::min(length, (size_t)5552);
+        for (size_t i = 0; i < chunk; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += chunk;
+        length -= chunk;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of two concatenated pieces from their own checksums, as in zlib's adler32_combine().
+static uint32_t adler32Combine(uint32_t first, uint32_t second, size_t secondLength) {
+
+    const uint32_t base = 65521;
+    uint32_t remainder = (uint32_t)(secondLength % base);
+    uint32_t sum1 = first & 0xffff;
+    uint32_t sum2 = (uint32_t)(((uint64_t)remainder * sum1) % base);
+    sum1 += (second & 0xffff) + base - 1;
+    sum2 += (first >> 16) + (second >> 16) + base - remainder;
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+    return sum1 | (sum2 << 16);
+}
+
+// CRC-32 of every byte value, for crc32().
+struct CrcTable {
+    uint32_t values[256];
+
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            values[i] = c;
+        }
+    }
+};
+
+static uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0) {
+
+    //built by the first call, the other threads wait for it
+    static const CrcTable table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void appendBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+static void appendChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t length) {
+    appendBigEndian(out, (uint32_t)length);
+    size_t typeStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + length);
+    appendBigEndian(out, crc32(&out[typeStart], length + 4));
+}
+
+static inline int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+// Filters one row with the filter type that gives the smallest sum of absolute values, the usual heuristic.
+static void filterRow(const unsigned char* row, const unsigned char* above, size_t rowBytes, int level, unsigned char* out) {
+
+    if (level == PNG_STORE) {
+        out[0] = 0;
+        memcpy(out + 1, row, rowBytes);
+        return;
+    }
+
+    const int bpp = 4;
+    int bestFilter = 0;
+    uint64_t bestSum = UINT64_MAX;
+    for (int filter = 0; filter < 5; ++filter) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < rowBytes && sum < bestSum; ++i) {
+            int left = i >= bpp ? row[i - bpp] : 0;
+            int up = above ? above[i] : 0;
+            int upLeft = above && i >= bpp ? above[i - bpp] : 0;
+            int predicted = filter == 0 ? 0 : filter == 1 ? left : filter == 2 ? up : filter == 3 ? (left + up) / 2 : paeth(left, up, upLeft);
+            sum += abs((int)(signed char)(unsigned char)(row[i] - predicted));
+        }
+        if (sum < bestSum) {
+            bestSum = sum;
+            bestFilter = filter;
+        }
+    }
+
+    out[0] = (unsigned char)bestFilter;
+    for (size_t i = 0; i < rowBytes; ++i) {
+        int left = i >= bpp ? row[i - bpp] : 0;
+        int up = above ? above[i] : 0;
+        int upLeft = above && i >= bpp ? above[i - bpp] : 0;
+        int predicted = bestFilter == 0 ? 0 : bestFilter == 1 ? left : bestFilter == 2 ? up : bestFilter == 3 ? (left + up) / 2 : paeth(left, up, upLeft);
+        out[1 + i] = (unsigned char)(row[i] - predicted);
+    }
+}
+
+PngWriter::PngWriter(size_t threadCount) : pool(threadCount) {
+}
+
+std::vector<unsigned char> PngWriter::encode(const unsigned char* pixels, uint32_t width, uint32_t height, int level) {
+
+    level = std::min(std::max(level, PNG_STORE), PNG_BEST_COMPRESSION);
+    size_t rowBytes = (size_t)width * 4;
+    size_t filteredRowBytes = rowBytes + 1;
+
+    //every row starts with its filter type byte
+    std::vector<unsigned char> filtered(filteredRowBytes * height);
+    pool.parallelFor(height, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            filterRow(pixels + y * rowBytes, y > 0 ? pixels + (y - 1) * rowBytes : NULL, rowBytes, level, &filtered[y * filteredRowBytes]);
+        }
+    });
+
+    //bands of at least 256KB, a few per thread so uneven bands still balance
+    size_t minimumBandRows = std::max((size_t)1, (size_t)(256 * 1024) / filteredRowBytes);
+    size_t bandCount = std::max((size_t)1, std::min((size_t)height / minimumBandRows, pool.size() * 4));
+    size_t bandRows = (height + bandCount - 1) / bandCount;
+    bandCount = height == 0 ? 1 : (height + bandRows - 1) / bandRows;
+
+    std::vector<std::vector<unsigned char> > bands(bandCount);
+    std::vector<uint32_t> bandAdlers(bandCount);
+    std::vector<size_t> bandLengths(bandCount);
+    pool.parallelFor(bandCount, [&](size_t begin, size_t end) {
+        for (size_t band = begin; band < end; ++band) {
+            size_t start = std::min(band * bandRows, (size_t)height) * filteredRowBytes;
+            size_t stop = std::min((band + 1) * bandRows, (size_t)height) * filteredRowBytes;
+            std::vector<unsigned char>& out = bands[band];
+            if (band == 0) {
+                //zlib header: deflate with a 32KB window, and the level hint
+                out.push_back(0x78);
+                out.push_back(level == PNG_STORE || level == 1 ? 0x01 : level < 7 ? 0x9c : 0xda);
+            }
+            deflateBand(filtered.data(), start, stop, level, band == bandCount - 1, out);
+            bandAdlers[band] = adler32(filtered.data() + start, stop - start);
+            bandLengths[band] = stop - start;
+        }
+    });
+
+    uint32_t adler = bandAdlers[0];
+    for (size_t band = 1; band < bandCount; ++band) {
+        adler = adler32Combine(adler, bandAdlers[band], bandLengths[band]);
+    }
+    appendBigEndian(bands[bandCount - 1], adler);
+
+    //the IDAT chunks, CRCs included, are built in parallel too
+    std::vector<std::vector<unsigned char> > chunks(bandCount);
+    pool.parallelFor(bandCount, [&](size_t begin, size_t end) {
+        for (size_t band = begin; band < end; ++band) {
+            appendChunk(chunks[band], "IDAT", bands[band].data(), bands[band].size());
+        }
+    });
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> png(signature, signature + 8);
+
+    //8 bit RGBA, deflate, adaptive filtering, no interlacing
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.push_back(8);
+    header.push_back(6);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    appendChunk(png, "IHDR", header.data(), header.size());
+
+    for (size_t band = 0; band < bandCount; ++band) {
+        png.insert(png.end(), chunks[band].begin(), chunks[band].end());
+    }
+    appendChunk(png, "IEND", NULL, 0);
+    return png;
+}
+
+bool PngWriter::write(const std::string& filename, const unsigned char* pixels, uint32_t width, uint32_t height, int level) {
+
+    std::vector<unsigned char> png = encode(pixels, width, height, level);
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    return file.write((const char*)png.data(), png.size()).good();
+}
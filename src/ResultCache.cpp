@@ -0,0 +1,238 @@
+#include "../include/ResultCache.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+double ResultCacheStats::hitRate() const {
+    return lookups == 0 ? 0.0 : (double)(memoryHits + diskHits) / lookups;
+}
+
+void ResultCacheStats::print() const {
+    cout << "result cache: " << memoryHits + diskHits << " hits of " << lookups << " lookups ("
+        << 100.0 * hitRate() << "%), " << diskHits << " from disk" << endl;
+    cout << "result cache saved " << uploadBytesSaved / (1024.0 * 1024.0) << " MB of uploads and served "
+        << resultBytesServed / (1024.0 * 1024.0) << " MB of output, " << memoryBytes / (1024.0 * 1024.0) << " MB in memory" << endl;
+}
+
+ResultCache::ResultCache(size_t memoryBudget, const std::string& directory)
+    : memoryBudget(memoryBudget), directory(directory) {
+}
+
+//XXH64 primes
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t round64(uint64_t accumulator, uint64_t input) {
+    accumulator += input * PRIME2;
+    return rotateLeft(accumulator, 31) * PRIME1;
+}
+
+static uint64_t mergeRound(uint64_t accumulator, uint64_t value) {
+    accumulator ^= round64(0, value);
+    return accumulator * PRIME1 + PRIME4;
+}
+
+uint64_t ResultCache::hash(const void* data, size_t size) {
+
+    //XXH64 with seed 0: four independent lanes over 32 byte stripes, then the tail. Little endian
+    //reads, like every platform this runs on.
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = PRIME1 + PRIME2;
+        uint64_t v2 = PRIME2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    }
+    else {
+        h = PRIME5;
+    }
+    h += (uint64_t)size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotateLeft(h, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME1;
+        h = rotateLeft(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * PRIME5;
+        h = rotateLeft(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string ResultCache::makeKey(const unsigned char* pixels, uint32_t width, uint32_t height, const std::string& settings) {
+
+    //also a file name
+    std::string versioned = "v" + std::to_string(RESULT_CACHE_VERSION) + " " + settings;
+    char key[64];
+    snprintf(key, sizeof(key), "%016llx%016llx-%ux%u",
+        (unsigned long long)hash(pixels, (size_t)width * height * 4),
+        (unsigned long long)hash(versioned.data(), versioned.size()), width, height);
+    return key;
+}
+
+std::string ResultCache::diskPath(const std::string& key) const {
+    return directory + "/" + key + ".result";
+}
+
+void ResultCache::insert(const std::string& key, std::shared_ptr<const std::vector<unsigned char>> file) {
+
+    //results larger than the whole budget would only push everything else out
+    if (file->size() > memoryBudget || entries.count(key) != 0) {
+        return;
+    }
+    recentKeys.push_front(key);
+    Entry entry = { file, recentKeys.begin() };
+    entries[key] = entry;
+    counters.memoryBytes += file->size();
+
+    while (counters.memoryBytes > memoryBudget) {
+        std::unordered_map<std::string, Entry>::iterator oldest = entries.find(recentKeys.back());
+        counters.memoryBytes -= oldest->second.file->size();
+        entries.erase(oldest);
+        recentKeys.pop_back();
+    }
+}
+
+bool ResultCache::lookup(const std::string& key, uint64_t inputBytes, std::shared_ptr<const std::vector<unsigned char>>& file) {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++counters.lookups;
+        std::unordered_map<std::string, Entry>::iterator found = entries.find(key);
+        if (found != entries.end()) {
+            //now the most recently used
+            recentKeys.splice(recentKeys.begin(), recentKeys, found->second.recent);
+            file = found->second.file;
+            ++counters.memoryHits;
+            counters.resultBytesServed += file->size();
+            counters.uploadBytesSaved += inputBytes;
+            return true;
+        }
+    }
+    if (directory.empty()) {
+        return false;
+    }
+
+    //read outside of the lock, other threads keep using the memory tier meanwhile
+    std::ifstream stream(diskPath(key), std::ios::binary | std::ios::ate);
+    if (!stream) {
+        return false;
+    }
+    std::shared_ptr<std::vector<unsigned char>> contents = std::make_shared<std::vector<unsigned char>>((size_t)stream.tellg());
+    stream.seekg(0);
+    if (!stream.read((char*)contents->data(), contents->size())) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    insert(key, contents);
+    file = contents;
+    ++counters.diskHits;
+    counters.resultBytesServed += file->size();
+    counters.uploadBytesSaved += inputBytes;
+    return true;
+}
+
+void ResultCache::store(const std::string& key, std::shared_ptr<const std::vector<unsigned char>> file) {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(key, file);
+        ++counters.stores;
+    }
+    if (directory.empty()) {
+        return;
+    }
+
+    //a result that could not be written is rendered again next time
+    writeFileReplacing(diskPath(key), file->data(), file->size());
+}
+
+ResultCacheStats ResultCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+bool writeFileReplacing(const std::string& path, const void* data, size_t size) {
+
+    //the process id keeps other processes out of this name, the counter the other threads of this one
+    static std::atomic<uint64_t> writes(0);
+    std::string temporaryPath = path + ".tmp" + std::to_string((long long)getpid()) + "." + std::to_string((unsigned long long)++writes);
+    {
+        std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!stream.write((const char*)data, size)) {
+            stream.close();
+            remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    //rename replaces an existing file in one step, except on Windows
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        remove(path.c_str());
+        if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
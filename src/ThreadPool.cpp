@@ -0,0 +1,91 @@
+#include "../include/ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount) : nextChunk(0) {
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    //the calling thread works too, so it counts as one of the threads
+    for (size_t i = 1; i < threadCount; ++i) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& function) {
+
+    if (count == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> call(callMutex);
+
+    //a few chunks per thread, so threads that finish early can help the slow ones
+    size_t chunkCount = size() * 4;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &function;
+    taskCount = count;
+    chunkSize = std::max<size_t>((count + chunkCount - 1) / chunkCount, 1);
+    nextChunk = 0;
+    busyWorkers = workers.size();
+    ++generation;
+    lock.unlock();
+    wake.notify_all();
+
+    runChunks();
+
+    lock.lock();
+    done.wait(lock, [this]() { return busyWorkers == 0; });
+    task = NULL;
+}
+
+void ThreadPool::workerLoop() {
+
+    uint64_t seenGeneration = 0;
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+        if (stopping) {
+            return;
+        }
+        seenGeneration = generation;
+        lock.unlock();
+
+        runChunks();
+
+        lock.lock();
+        if (--busyWorkers == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::runChunks() {
+
+    while (true) {
+        size_t begin = nextChunk++ * chunkSize;
+        if (begin >= taskCount) {
+            return;
+        }
+        size_t end = std::min(begin + chunkSize, taskCount);
+        (*task)(begin, end);
+    }
+}
@@ -0,0 +1,100 @@
+#include "../include/TimingReport.h"
+
+#include <fstream>
+#include <stdexcept>
+
+// Escapes the characters JSON does not allow in strings. File names rarely have any.
+static std::string jsonString(const std::string& value) {
+    std::string escaped = "\"";
+    for (size_t i = 0; i < value.size(); ++i) {
+        char c = value[i];
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            escaped += ' ';
+        }
+        else {
+            escaped += c;
+        }
+    }
+    return escaped + "\"";
+}
+
+// CSV fields are quoted when they contain a separator or a quote.
+static std::string csvField(const std::string& value) {
+    if (value.find_first_of(",\"\n") == std::string::npos) {
+        return value;
+    }
+    std::string quoted = "\"";
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '"') {
+            quoted += '"';
+        }
+        quoted += value[i];
+    }
+    return quoted + "\"";
+}
+
+void ImageTimings::add(const std::string& stage, double ms) {
+    stages.push_back(std::make_pair(stage, ms));
+}
+
+void TimingReport::add(const ImageTimings& timings) {
+    std::lock_guard<std::mutex> lock(mutex);
+    images.push_back(timings);
+}
+
+void TimingReport::writeJson(const std::string& filename) {
+
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to write timings to " + filename);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    file << "[\n";
+    for (size_t i = 0; i < images.size(); ++i) {
+        const ImageTimings& timings = images[i];
+        file << "  {\"image\": " << jsonString(timings.image)
+            << ", \"kernel\": " << jsonString(timings.kernel)
+            << ", \"width\": " << timings.width
+            << ", \"height\": " << timings.height
+            << ", \"stages\": {";
+        for (size_t j = 0; j < timings.stages.size(); ++j) {
+            file << (j == 0 ? "" : ", ") << jsonString(timings.stages[j].first) << ": " << timings.stages[j].second;
+        }
+        file << "}}" << (i + 1 < images.size() ? "," : "") << "\n";
+    }
+    file << "]\n";
+}
+
+void TimingReport::writeCsv(const std::string& filename) {
+
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to write timings to " + filename);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    file << "image,kernel,width,height,stage,ms\n";
+    for (size_t i = 0; i < images.size(); ++i) {
+        const ImageTimings& timings = images[i];
+        for (size_t j = 0; j < timings.stages.size(); ++j) {
+            file << csvField(timings.image) << "," << timings.kernel << "," << timings.width << "," << timings.height << ","
+                << timings.stages[j].first << "," << timings.stages[j].second << "\n";
+        }
+    }
+}
+
+void TimingReport::write(const std::string& filename) {
+
+    size_t extension = filename.rfind('.');
+    if (extension != std::string::npos && filename.substr(extension) == ".csv") {
+        writeCsv(filename);
+    }
+    else {
+        writeJson(filename);
+    }
+}
@@ -0,0 +1,362 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "../include/ComputeApplication.h"
+using namespace std;
+
+/*
+Benchmark for the compute kernels. Runs every combination of image size, pixel format, blur mode,
+blur size and saturation on synthetic images and reports throughput, GPU time and host overhead.
+Needs no image files or window, so it also runs on a software driver such as lavapipe:
+
+    VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json ./vulkan_minimal_compute_benchmark
+
+usage: vulkan_minimal_compute_benchmark [--sizes 256,1024,4096x2048] [--blurs 5,25,51]
+    [--saturations 1.7] [--modes separable,tiled,box] [--formats rgba8,rgba16f,rgba32f]
+    [--command-reuse off,on] [--incremental on] [--warmup 2] [--repeat 5] [--csv results.csv]
+
+Every configuration runs with and without reusing the recorded command buffer by default,
+"record ms" is the host time prepareFrame() spent recording per job.
+--incremental on also times processIncremental() for every size and blur size: the first full
+blur, a new saturation on the kept blur, like dragging a slider, and a changed 64x64 rectangle.
+*/
+
+struct BenchmarkConfig {
+    std::vector<std::pair<uint32_t, uint32_t> > sizes;
+    std::vector<int32_t> blurs;
+    std::vector<float> saturations;
+    std::vector<BlurMode> modes;
+    std::vector<PixelFormat> formats;
+    std::vector<bool> commandReuse;
+    bool incremental = false;
+    int warmup = 2;
+    int repeat = 5;
+    std::string csvFile;
+};
+
+//median, mean, min and standard deviation of the repetitions
+struct Statistics {
+    double median = 0.0;
+    double mean = 0.0;
+    double min = 0.0;
+    double stddev = 0.0;
+};
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static Statistics computeStatistics(std::vector<double> samples) {
+    Statistics stats;
+    if (samples.empty()) {
+        return stats;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    stats.min = samples[0];
+    stats.median = count % 2 == 1 ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += samples[i];
+    }
+    stats.mean = sum / count;
+
+    double squares = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        squares += (samples[i] - stats.mean) * (samples[i] - stats.mean);
+    }
+    stats.stddev = count > 1 ? sqrt(squares / (count - 1)) : 0.0;
+    return stats;
+}
+
+// Deterministic test image: smooth gradients with hard edges and noise, so neither the
+// blur nor the saturation work on flat data.
+static Image createSyntheticImage(uint32_t width, uint32_t height) {
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t)width * height * 4);
+
+    uint32_t random = 2463534242u;
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            //xorshift32
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+
+            unsigned char* pixel = &image.pixels[((size_t)y * width + x) * 4];
+            bool checker = ((x / 32) + (y / 32)) % 2 == 0;
+            pixel[0] = (unsigned char)(x * 255 / max(width - 1, 1u));
+            pixel[1] = (unsigned char)(y * 255 / max(height - 1, 1u));
+            pixel[2] = (unsigned char)(checker ? 200 + (random & 31) : (random & 63));
+            pixel[3] = 255;
+        }
+    }
+    return image;
+}
+
+static bool parseArguments(int argc, char* argv[], BenchmarkConfig& config) {
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        string value = argv[++i];
+        std::vector<std::string> items = splitList(value);
+
+        if (arg == "--sizes") {
+            config.sizes.clear();
+            for (size_t j = 0; j < items.size(); ++j) {
+                //either N for a square image or WxH
+                uint32_t width = (uint32_t)atoi(items[j].c_str());
+                size_t separator = items[j].find('x');
+                uint32_t height = separator == std::string::npos ? width : (uint32_t)atoi(items[j].c_str() + separator + 1);
+                if (width == 0 || height == 0) {
+                    return false;
+                }
+                config.sizes.push_back(std::make_pair(width, height));
+            }
+        }
+        else if (arg == "--blurs") {
+            config.blurs.clear();
+            for (size_t j = 0; j < items.size(); ++j) {
+                config.blurs.push_back(atoi(items[j].c_str()));
+            }
+        }
+        else if (arg == "--saturations") {
+            config.saturations.clear();
+            for (size_t j = 0; j < items.size(); ++j) {
+                config.saturations.push_back((float)atof(items[j].c_str()));
+            }
+        }
+        else if (arg == "--modes") {
+            config.modes.clear();
+            for (size_t j = 0; j < items.size(); ++j) {
+                if (items[j] == "reference") config.modes.push_back(BLUR_MODE_REFERENCE);
+                else if (items[j] == "separable") config.modes.push_back(BLUR_MODE_SEPARABLE);
+                else if (items[j] == "tiled") config.modes.push_back(BLUR_MODE_TILED);
+                else if (items[j] == "box") config.modes.push_back(BLUR_MODE_BOX);
+                else return false;
+            }
+        }
+        else if (arg == "--formats") {
+            config.formats.clear();
+            for (size_t j = 0; j < items.size(); ++j) {
+                if (items[j] == "rgba8") config.formats.push_back(PIXEL_FORMAT_RGBA8);
+                else if (items[j] == "rgba16f") config.formats.push_back(PIXEL_FORMAT_RGBA16F);
+                else if (items[j] == "rgba32f") config.formats.push_back(PIXEL_FORMAT_RGBA32F);
+                else return false;
+            }
+        }
+        else if (arg == "--command-reuse") {
+            config.commandReuse.clear();
+            for (size_t j = 0; j < items.size(); ++j) {
+                if (items[j] == "on") config.commandReuse.push_back(true);
+                else if (items[j] == "off") config.commandReuse.push_back(false);
+                else return false;
+            }
+        }
+        else if (arg == "--incremental") {
+            if (value != "on" && value != "off") {
+                return false;
+            }
+            config.incremental = value == "on";
+        }
+        else if (arg == "--warmup") {
+            config.warmup = max(atoi(value.c_str()), 0);
+        }
+        else if (arg == "--repeat") {
+            config.repeat = max(atoi(value.c_str()), 1);
+        }
+        else if (arg == "--csv") {
+            config.csvFile = value;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+
+    BenchmarkConfig config;
+    config.sizes.push_back(std::make_pair(256u, 256u));
+    config.sizes.push_back(std::make_pair(1024u, 1024u));
+    config.sizes.push_back(std::make_pair(2048u, 2048u));
+    config.blurs.push_back(5);
+    config.blurs.push_back(25);
+    config.blurs.push_back(51);
+    config.saturations.push_back(1.7f);
+    config.modes.push_back(BLUR_MODE_SEPARABLE);
+    config.modes.push_back(BLUR_MODE_TILED);
+    config.formats.push_back(PIXEL_FORMAT_RGBA8);
+    config.commandReuse.push_back(false);
+    config.commandReuse.push_back(true);
+
+    if (!parseArguments(argc, argv, config)) {
+        printf("usage: vulkan_minimal_compute_benchmark [--sizes 256,1024,4096x2048] [--blurs 5,25,51] [--saturations 1.7]\n"
+            "    [--modes reference,separable,tiled,box] [--formats rgba8,rgba16f,rgba32f] [--command-reuse off,on]\n"
+            "    [--incremental on] [--warmup N] [--repeat N] [--csv FILE]\n");
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream csv;
+    if (!config.csvFile.empty()) {
+        csv.open(config.csvFile);
+        if (!csv.is_open()) {
+            printf("could not open %s\n", config.csvFile.c_str());
+            return EXIT_FAILURE;
+        }
+        csv << "width,height,format,mode,kernel,blur,saturation,repeat,wall_median_ms,wall_mean_ms,wall_min_ms,wall_stddev_ms,"
+            "gpu_median_ms,host_overhead_ms,command_reuse,record_median_ms,megapixels_per_second\n";
+    }
+
+    const char* formatNames[] = { "rgba32f", "rgba8", "rgba16f" };
+
+    printf("%-11s %-8s %-10s %-10s %5s %5s %5s %10s %10s %10s %10s %10s %10s\n",
+        "size", "format", "mode", "kernel", "blur", "sat", "reuse", "wall ms", "+-", "gpu ms", "host ms", "record ms", "MP/s");
+
+    try {
+        //the pixel format is fixed at init(), so every format gets its own context
+        for (size_t f = 0; f < config.formats.size(); ++f) {
+            ComputeApplication app;
+            app.setPixelFormat(config.formats[f]);
+            app.setVerbose(false);
+            app.init();
+
+            for (size_t s = 0; s < config.sizes.size(); ++s) {
+                Image input = createSyntheticImage(config.sizes[s].first, config.sizes[s].second);
+                double megapixels = (double)input.width * input.height / 1000000.0;
+
+                for (size_t m = 0; m < config.modes.size(); ++m) {
+                    for (size_t b = 0; b < config.blurs.size(); ++b) {
+                        for (size_t t = 0; t < config.saturations.size(); ++t) {
+                            for (size_t r = 0; r < config.commandReuse.size(); ++r) {
+                                app.setReuseCommandBuffers(config.commandReuse[r]);
+                                FilterParams params;
+                                params.blurMode = config.modes[m];
+                                params.blur = config.blurs[b];
+                                params.saturation = config.saturations[t];
+
+                                //warm-up compiles the pipelines and grows the buffers
+                                for (int i = 0; i < config.warmup; ++i) {
+                                    app.process(input, params);
+                                }
+
+                                std::vector<double> wallTimes;
+                                std::vector<double> gpuTimes;
+                                std::vector<double> recordTimes;
+                                std::string kernel;
+                                for (int i = 0; i < config.repeat; ++i) {
+                                    auto start = std::chrono::high_resolution_clock::now();
+                                    app.process(input, params);
+                                    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                                    wallTimes.push_back(elapsed.count());
+
+                                    const ImageTimings& timings = app.lastTimings();
+                                    kernel = timings.kernel;
+                                    for (size_t j = 0; j < timings.stages.size(); ++j) {
+                                        if (timings.stages[j].first == "gpu_total") {
+                                            gpuTimes.push_back(timings.stages[j].second);
+                                        }
+                                        else if (timings.stages[j].first == "record") {
+                                            recordTimes.push_back(timings.stages[j].second);
+                                        }
+                                    }
+                                }
+
+                                Statistics wall = computeStatistics(wallTimes);
+                                Statistics gpu = computeStatistics(gpuTimes);
+                                Statistics record = computeStatistics(recordTimes);
+                                double hostOverhead = gpuTimes.empty() ? 0.0 : wall.median - gpu.median;
+                                double throughput = megapixels / (wall.median / 1000.0);
+
+                                char sizeName[32];
+                                snprintf(sizeName, sizeof(sizeName), "%ux%u", input.width, input.height);
+                                const char* reuse = config.commandReuse[r] ? "on" : "off";
+                                printf("%-11s %-8s %-10s %-10s %5d %5.2f %5s %10.3f %10.3f %10.3f %10.3f %10.3f %10.1f\n",
+                                    sizeName, formatNames[config.formats[f]], ComputeApplication::blurModeName(params.blurMode), kernel.c_str(),
+                                    params.blur, params.saturation, reuse, wall.median, wall.stddev, gpu.median, hostOverhead, record.median, throughput);
+
+                                if (csv.is_open()) {
+                                    csv << input.width << "," << input.height << "," << formatNames[config.formats[f]] << ","
+                                        << ComputeApplication::blurModeName(params.blurMode) << "," << kernel << ","
+                                        << params.blur << "," << params.saturation << "," << config.repeat << ","
+                                        << wall.median << "," << wall.mean << "," << wall.min << "," << wall.stddev << ","
+                                        << gpu.median << "," << hostOverhead << "," << reuse << "," << record.median << ","
+                                        << throughput << "\n";
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            //median wall time of the three kinds of processIncremental() calls
+            for (size_t s = 0; config.incremental && s < config.sizes.size(); ++s) {
+                Image input = createSyntheticImage(config.sizes[s].first, config.sizes[s].second);
+                ImageRect changed;
+                changed.x = input.width / 2;
+                changed.y = input.height / 2;
+                changed.width = min(64u, input.width - changed.x);
+                changed.height = min(64u, input.height - changed.y);
+
+                for (size_t b = 0; b < config.blurs.size(); ++b) {
+                    FilterParams params;
+                    params.blur = config.blurs[b];
+                    for (int i = 0; i < config.warmup; ++i) {
+                        app.processIncremental(input, params, changed);
+                    }
+
+                    std::vector<double> fullTimes;
+                    std::vector<double> sliderTimes;
+                    std::vector<double> changedTimes;
+                    for (int i = 0; i < config.repeat; ++i) {
+                        //another blur size throws the kept blur away
+                        FilterParams other = params;
+                        other.blur = params.blur + 2;
+                        app.processIncremental(input, other);
+
+                        auto start = std::chrono::high_resolution_clock::now();
+                        app.processIncremental(input, params);
+                        fullTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+
+                        params.saturation = 1.0f + 0.1f * i;
+                        start = std::chrono::high_resolution_clock::now();
+                        app.processIncremental(input, params);
+                        sliderTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+
+                        start = std::chrono::high_resolution_clock::now();
+                        app.processIncremental(input, params, changed);
+                        changedTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+                    }
+
+                    printf("incremental %ux%u %s blur %d: full %.3f ms, saturation only %.3f ms, 64x64 changed %.3f ms\n",
+                        input.width, input.height, formatNames[config.formats[f]], params.blur,
+                        computeStatistics(fullTimes).median, computeStatistics(sliderTimes).median, computeStatistics(changedTimes).median);
+                }
+            }
+
+            app.cleanup();
+        }
+    }
+    catch (const std::runtime_error& e) {
+        printf("%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
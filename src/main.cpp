@@ -1,14 +1,314 @@
 #include <iostream>
+#include <memory>
 #include "../include/ComputeApplication.h"
+#include "../include/CpuEngine.h"
+#include "../include/JobServer.h"
+#include "../include/ResultCache.h"
 using namespace std;
 
 //On master branch
-int main() {
+//usage: vulkan_minimal_compute [options] [input output]...
+int main(int argc, char* argv[]) {
     ComputeApplication app;
+    FilterParams params;
+    int framesInFlight = 0;
+    int pngLevel = PNG_DEFAULT_COMPRESSION;
+    bool pipelineCacheStats = false;
+    bool memoryStats = false;
+    string timingsFile;
+    TimingReport timingReport;
+    string engine = "auto";
+    bool verify = false;
+    bool autotune = false;
+    string graphDescription;
+    string serverSocket;
+    string sendSocket;
+    bool stopServer = false;
+    int queueCapacity = 64;
+    int cacheMegabytes = 0;
+    string cacheDirectory;
+
+    //input and output file names, in pairs
+    std::vector<string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+
+        //--reference runs the original single pass kernel, for comparing against the separable blur.
+        //--separable runs the separable blur straight from the storage buffers instead of shared memory tiles.
+        if (arg == "--reference") {
+            params.blurMode = BLUR_MODE_REFERENCE;
+        }
+        else if (arg == "--separable") {
+            params.blurMode = BLUR_MODE_SEPARABLE;
+        }
+        //--box always runs the constant time box blur, --box-radius R uses it above radius R, 0 never
+        else if (arg == "--box") {
+            params.blurMode = BLUR_MODE_BOX;
+        }
+        else if (arg == "--box-radius" && i + 1 < argc) {
+            app.setBoxBlurRadius(atoi(argv[++i]));
+        }
+        //pixel format of the GPU buffers, rgba8 by default
+        else if (arg == "--rgba32f") {
+            app.setPixelFormat(PIXEL_FORMAT_RGBA32F);
+        }
+        else if (arg == "--rgba16f") {
+            app.setPixelFormat(PIXEL_FORMAT_RGBA16F);
+        }
+        else if (arg == "--blur" && i + 1 < argc) {
+            params.blur = atoi(argv[++i]);
+        }
+        else if (arg == "--saturation" && i + 1 < argc) {
+            params.saturation = (float)atof(argv[++i]);
+        }
+        //--graph "blur=25,brightness=10:1.2,gamma=2.2,resize=960x540,sharpen=0.5" runs a filter graph
+        //instead of the blur, tint and saturation, see FilterGraph.h
+        else if (arg == "--graph" && i + 1 < argc) {
+            graphDescription = argv[++i];
+        }
+        //--no-specialize always runs the generic kernels instead of variants compiled for the blur size
+        else if (arg == "--no-specialize") {
+            app.setSpecializeBlurSize(false);
+        }
+        //--no-command-reuse records the commands of every job again, to compare the host overhead
+        else if (arg == "--no-command-reuse") {
+            app.setReuseCommandBuffers(false);
+        }
+        //--autotune times the workgroup sizes on the first input image, or the sample image for a server,
+        //and saves the fastest for later runs, --workgroup-profile FILE moves that profile
+        else if (arg == "--autotune") {
+            autotune = true;
+        }
+        else if (arg == "--workgroup-profile" && i + 1 < argc) {
+            app.setWorkgroupProfileFile(argv[++i]);
+        }
+        //--pipeline-cache FILE moves the pipeline cache, --no-pipeline-cache disables it,
+        //--pipeline-cache-stats reports the time the cache saved
+        else if (arg == "--pipeline-cache" && i + 1 < argc) {
+            app.setPipelineCacheFile(argv[++i]);
+        }
+        else if (arg == "--no-pipeline-cache") {
+            app.setPipelineCacheFile("");
+        }
+        else if (arg == "--pipeline-cache-stats") {
+            pipelineCacheStats = true;
+        }
+        //--memory-stats reports device memory use and fragmentation before cleanup
+        else if (arg == "--memory-stats") {
+            memoryStats = true;
+        }
+        //--timings FILE writes per image stage timings, as CSV for .csv files and JSON otherwise
+        else if (arg == "--timings" && i + 1 < argc) {
+            timingsFile = argv[++i];
+        }
+        //--tile-budget MB splits images whose buffers would be larger into tiles
+        else if (arg == "--tile-budget" && i + 1 < argc) {
+            app.setTileMemoryBudget((VkDeviceSize)atoi(argv[++i]) * 1024 * 1024);
+        }
+        //--png-level 0-9, 0 stores the png output uncompressed, the fastest to write
+        else if (arg == "--png-level" && i + 1 < argc) {
+            pngLevel = atoi(argv[++i]);
+            app.setPngCompressionLevel(pngLevel);
+        }
+        //--batch N keeps N images in flight, overlapping decode, upload, compute and encode
+        else if (arg == "--batch" && i + 1 < argc) {
+            framesInFlight = atoi(argv[++i]);
+        }
+        //--engine gpu|cpu|auto|hybrid. auto uses the CPU engine when there is no Vulkan device,
+        //hybrid lets the CPU engine take a share of the images in batch mode
+        else if (arg == "--engine" && i + 1 < argc) {
+            engine = argv[++i];
+        }
+        //--verify compares every GPU result against the CPU engine
+        else if (arg == "--verify") {
+            verify = true;
+        }
+        //--server SOCKET keeps the device warm and runs the jobs local clients send, see JobServer.h.
+        //--queue N bounds the jobs waiting in it.
+        //--send SOCKET sends the files to a running server instead, or asks it for its stats without files,
+        //--stop-server SOCKET lets it finish its queue and exit
+        else if (arg == "--server" && i + 1 < argc) {
+            serverSocket = argv[++i];
+        }
+        else if (arg == "--queue" && i + 1 < argc) {
+            queueCapacity = atoi(argv[++i]);
+        }
+        else if (arg == "--send" && i + 1 < argc) {
+            sendSocket = argv[++i];
+        }
+        else if (arg == "--stop-server" && i + 1 < argc) {
+            sendSocket = argv[++i];
+            stopServer = true;
+        }
+        //--cache MB keeps the results of up to MB megabytes in memory and writes them again when the same
+        //image comes with the same settings, --cache-dir DIR keeps every result in DIR across runs as well
+        else if (arg == "--cache" && i + 1 < argc) {
+            cacheMegabytes = atoi(argv[++i]);
+        }
+        else if (arg == "--cache-dir" && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+
+    //a client of a running server needs no device
+    if (!sendSocket.empty()) {
+        if (files.size() % 2 != 0) {
+            printf("usage: vulkan_minimal_compute --send SOCKET [input output]...\n");
+            return EXIT_FAILURE;
+        }
+        try {
+            JobClient client(sendSocket);
+            if (stopServer) {
+                cout << client.request("quit") << endl;
+            }
+            else if (files.empty()) {
+                cout << client.request("stats") << endl;
+            }
+            for (size_t i = 0; i < files.size(); i += 2) {
+                string request = "process\tinput=" + files[i] + "\toutput=" + files[i + 1];
+                if (!graphDescription.empty()) {
+                    request += "\tgraph=" + graphDescription;
+                }
+                cout << files[i] << ": " << client.request(request) << endl;
+            }
+        }
+        catch (const std::runtime_error& e) {
+            printf("%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    //without any files, blur the sample image and open the result
+    std::string sampleImage = "resources/images/beach.png";
+    bool openResult = files.empty() && serverSocket.empty();
+    if (openResult) {
+        files.push_back(sampleImage);
+        files.push_back("Simple Image.png");
+    }
+    if (files.size() % 2 != 0 || (engine != "gpu" && engine != "cpu" && engine != "auto" && engine != "hybrid")) {
+        printf("usage: vulkan_minimal_compute [options] [input output]...\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<BatchJob> jobs;
+    for (size_t i = 0; i < files.size(); i += 2) {
+        BatchJob job = { files[i], files[i + 1] };
+        jobs.push_back(job);
+    }
 
     cout << "Running Compute Application" << endl;
     try {
-        app.run();
+        if (!graphDescription.empty()) {
+            params.graph = std::make_shared<FilterGraph>(FilterGraph::parse(graphDescription));
+        }
+
+        std::unique_ptr<CpuEngine> cpuEngine;
+        std::unique_ptr<ResultCache> resultCache;
+        if (engine != "gpu") {
+            cpuEngine.reset(new CpuEngine());
+        }
+
+        //Vulkan is set up once, every image reuses the same device, pipelines and buffers
+        bool useGpu = engine != "cpu";
+        if (useGpu) {
+            if (framesInFlight > 0) {
+                app.setFramesInFlight(framesInFlight);
+            }
+            else if (!serverSocket.empty()) {
+                app.setFramesInFlight(2);
+            }
+            if (!timingsFile.empty()) {
+                app.setTimingReport(&timingReport);
+            }
+            if (cacheMegabytes > 0 || !cacheDirectory.empty()) {
+                size_t budget = cacheMegabytes > 0 ? (size_t)cacheMegabytes * 1024 * 1024 : 256 * 1024 * 1024;
+                resultCache.reset(new ResultCache(budget, cacheDirectory));
+                app.setResultCache(resultCache.get());
+            }
+            try {
+                app.init();
+            }
+            catch (const std::runtime_error& e) {
+                if (engine != "auto") {
+                    throw;
+                }
+                cout << e.what() << ", falling back to the CPU engine" << endl;
+                useGpu = false;
+            }
+        }
+
+        if (useGpu && autotune) {
+            //a server started without files has no input image of its own
+            app.autotune(ComputeApplication::loadImage(jobs.empty() ? sampleImage : jobs[0].input), params);
+        }
+
+        //the CPU engine only has the fixed filters
+        if (params.graph && (!useGpu || verify)) {
+            throw std::runtime_error("filter graphs need the GPU engine and can not be verified");
+        }
+        if (useGpu && verify && app.usesBoxBlur(params)) {
+            throw std::runtime_error("the box blur approximates the gaussian and can not be verified, use --box-radius 0");
+        }
+        if (!serverSocket.empty() && !useGpu) {
+            throw std::runtime_error("the job server needs the GPU engine");
+        }
+
+        if (!useGpu) {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                Image input = ComputeApplication::loadImage(jobs[i].input);
+                ComputeApplication::saveImage(cpuEngine->process(input, params), jobs[i].output, pngLevel);
+            }
+        }
+        else if (verify && cpuEngine) {
+            //the CPU engine is the golden reference, results only differ by float rounding
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                Image input = ComputeApplication::loadImage(jobs[i].input);
+                Image output = app.process(input, params);
+                ImageDifference difference = CpuEngine::compare(output, cpuEngine->process(input, params), 1);
+                cout << jobs[i].input << ": max difference to the CPU engine " << difference.maxDifference
+                    << ", " << difference.differingPixels << " pixels off by more than 1" << endl;
+                ComputeApplication::saveImage(output, jobs[i].output, pngLevel);
+            }
+        }
+        else if (!serverSocket.empty()) {
+            //two frames at least, so the batches of the server overlap upload, compute and readback
+            JobServer server(app, params, (size_t)max(queueCapacity, 1), (size_t)max(framesInFlight, 2));
+            server.run(serverSocket);
+            cout << server.stats().toJson() << endl;
+        }
+        else if (framesInFlight > 0) {
+            if (engine == "hybrid") {
+                app.setCpuCoprocessor(cpuEngine.get());
+            }
+            app.processBatch(jobs, params).print();
+        }
+        else {
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                app.processFile(jobs[i], params);
+            }
+        }
+
+        if (useGpu) {
+            if (pipelineCacheStats) {
+                app.printPipelineCacheStats();
+            }
+            if (memoryStats) {
+                app.printMemoryStats();
+            }
+            if (resultCache) {
+                resultCache->stats().print();
+            }
+            app.cleanup();
+        }
+
+        if (!timingsFile.empty()) {
+            timingReport.write(timingsFile);
+        }
     }
     catch (const std::runtime_error& e) {
         printf("%s\n", e.what());
@@ -16,6 +316,8 @@ int main() {
     }
     
     //open image
-    system("\"Simple Image.png\"");
+    if (openResult) {
+        system("\"Simple Image.png\"");
+    }
     return EXIT_SUCCESS;
 }
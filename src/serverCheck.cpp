@@ -0,0 +1,107 @@
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include "../include/ComputeApplication.h"
+#include "../include/JobServer.h"
+using namespace std;
+
+/*
+Check of the job server through a local JobClient, like a real client would use it. Starts a
+server on a small synthetic image, sends jobs that must fail next to jobs that must work, and
+checks that every bad job gets an error reply while the server keeps running the good ones.
+Needs a Vulkan device, a software driver such as lavapipe is enough. Exits with 1 on any failure.
+
+usage: vulkan_minimal_compute_server_check [SOCKET]
+*/
+
+static int failures = 0;
+
+static void expectReply(JobClient& client, const std::string& request, const std::string& prefix) {
+
+    std::string reply = client.request(request);
+    bool passed = reply.compare(0, prefix.size(), prefix) == 0;
+    if (!passed) {
+        ++failures;
+    }
+    cout << (passed ? "pass: " : "FAIL: ") << request << " -> " << reply << endl;
+}
+
+int main(int argc, char* argv[]) {
+
+    std::string socketPath = argc > 1 ? argv[1] : "/tmp/vulkan_minimal_compute_check.sock";
+    std::string input = "server_check.64x48.rgba";
+
+    Image image;
+    image.width = 64;
+    image.height = 48;
+    image.pixels.resize((size_t)image.width * image.height * 4);
+    for (size_t i = 0; i < image.pixels.size(); ++i) {
+        image.pixels[i] = (unsigned char)(i * 7);
+    }
+
+    try {
+        ComputeApplication::saveImage(image, input);
+
+        ComputeApplication app;
+        app.setVerbose(false);
+        app.setFramesInFlight(2);
+        app.init();
+
+        FilterParams defaults;
+        defaults.blur = 9;
+        JobServer server(app, defaults, 8, 4);
+        std::thread serverThread([&]() { server.run(socketPath); });
+
+        //the server listens once run() created the socket
+        std::unique_ptr<JobClient> client;
+        for (int attempt = 0; !client; ++attempt) {
+            try {
+                client.reset(new JobClient(socketPath));
+            }
+            catch (const std::runtime_error&) {
+                if (attempt == 100) {
+                    throw;
+                }
+                usleep(50000);
+            }
+        }
+
+        std::string process = "process\tinput=" + input + "\toutput=server_check_out.png";
+        expectReply(*client, process, "ok");
+
+        //rejected before they reach the queue
+        expectReply(*client, process + "\tblur=0", "error");
+        expectReply(*client, process + "\tblur=abc", "error");
+        expectReply(*client, process + "\tblur=100000", "error");
+        expectReply(*client, process + "\tsaturation=x", "error");
+        expectReply(*client, process + "\ttint=1:1:1", "error");
+        expectReply(*client, process + "\tgraph=nothing=1", "error");
+        expectReply(*client, process + "\tgraph=resize=40000x40000", "error");
+        expectReply(*client, process + "\tgraph=blur=100001", "error");
+        expectReply(*client, "process\toutput=server_check_out.png", "error");
+
+        //fail on the device side, in the same batch as a job that works
+        std::string missing = "process\tinput=server_check_missing.png\toutput=server_check_missing_out.png";
+        std::thread otherClient([&]() {
+            JobClient second(socketPath);
+            expectReply(second, missing, "error");
+        });
+        expectReply(*client, process, "ok");
+        otherClient.join();
+
+        //the server is still up
+        expectReply(*client, process + "\tblur=25\tsaturation=1.2\ttint=1:0.5:0.5:1", "ok");
+        expectReply(*client, "stats", "{");
+        expectReply(*client, "quit", "ok");
+
+        serverThread.join();
+        app.cleanup();
+    }
+    catch (const std::runtime_error& e) {
+        cout << "FAIL: " << e.what() << endl;
+        ++failures;
+    }
+
+    cout << (failures == 0 ? "all checks passed" : std::to_string(failures) + " checks failed") << endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}